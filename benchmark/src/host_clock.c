@@ -0,0 +1,11 @@
+// Built for the host side of native_sim, where the host libc is available.
+
+#include <stdint.h>
+#include <time.h>
+
+uint64_t asdc_bench_host_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
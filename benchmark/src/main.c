@@ -0,0 +1,283 @@
+// Throughput and latency benchmark of the arbitrary split data channel module over the loopback
+// transport. Every run sends a fixed number of messages spread over some channels and reports
+// messages/s, bytes/s, the p50/p99 latency from asdc_send() to the recv callback and how many
+// messages were dropped because a queue was full. With compression enabled, the codecs are
+// compared on some typical payloads first.
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arbitrary_split_data_channel.h>
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define BENCH_MESSAGES 1000
+#define BENCH_MAX_PAYLOAD 500
+#define BENCH_DRAIN_TIMEOUT_MS 1000
+
+#if defined(CONFIG_NATIVE_LIBRARY)
+uint64_t asdc_bench_host_clock_ns(void);
+#define bench_clock_ns() asdc_bench_host_clock_ns()
+#else
+#define bench_clock_ns() k_cyc_to_ns_floor64(k_cycle_get_64())
+#endif
+
+struct bench_header {
+    uint32_t run;
+    uint32_t seq;
+    uint64_t sent_ns;
+} __packed;
+
+struct bench_params {
+    size_t payload;
+    size_t channels;
+    // messages sent back to back before the sender sleeps and lets the queues drain
+    size_t burst;
+};
+
+static const struct device *const bench_channels[] = {
+    DEVICE_DT_GET(DT_NODELABEL(asdc_bench0)),
+    DEVICE_DT_GET(DT_NODELABEL(asdc_bench1)),
+    DEVICE_DT_GET(DT_NODELABEL(asdc_bench2)),
+    DEVICE_DT_GET(DT_NODELABEL(asdc_bench3)),
+};
+
+static const size_t bench_payloads[] = {16, 64, 256, BENCH_MAX_PAYLOAD};
+static const size_t bench_channel_counts[] = {1, 2, 4};
+static const size_t bench_bursts[] = {1, 32};
+
+// state of the current run, only written by the recv callback once the run started
+static struct {
+    uint32_t run;
+    uint32_t received;
+    uint64_t rx_bytes;
+    uint64_t last_rx_ns;
+    uint32_t latencies_ns[BENCH_MESSAGES];
+} bench;
+
+static uint8_t bench_payload[BENCH_MAX_PAYLOAD];
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+#define BENCH_CODEC_ROUNDS 200
+
+static uint8_t bench_codec_in[BENCH_MAX_PAYLOAD];
+static uint8_t bench_codec_out[BENCH_MAX_PAYLOAD + BENCH_MAX_PAYLOAD / 32 + 1];
+static uint8_t bench_codec_check[BENCH_MAX_PAYLOAD];
+
+// a 1 bit per pixel status screen, mostly blank with a few glyph rows
+static void bench_fill_display(uint8_t *buf, size_t len)
+{
+    memset(buf, 0, len);
+    for (size_t i = 64; i + 16 <= len && i < 192; i += 16) {
+        for (size_t j = 0; j < 8; j++) {
+            buf[i + j] = (uint8_t)(0x3c + j * 0x11);
+        }
+    }
+}
+
+static void bench_fill_text(uint8_t *buf, size_t len)
+{
+    static const char words[] = "layer 0 battery 87% peripheral connected caps lock off ";
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = words[i % (sizeof(words) - 1)];
+    }
+}
+
+static void bench_fill_random(uint8_t *buf, size_t len)
+{
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = (uint8_t)x;
+    }
+}
+
+static void bench_codecs(void)
+{
+    static const struct {
+        const char *name;
+        void (*fill)(uint8_t *buf, size_t len);
+    } inputs[] = {
+        {"display", bench_fill_display},
+        {"text", bench_fill_text},
+        {"random", bench_fill_random},
+    };
+    static const struct {
+        const char *name;
+        enum asdc_codec codec;
+    } codecs[] = {
+        {"lzf", ASDC_CODEC_LZF},
+        {"rle", ASDC_CODEC_RLE},
+    };
+
+    printk("input   codec   bytes  compressed  encode(ns)  decode(ns)\n");
+
+    for (size_t i = 0; i < ARRAY_SIZE(inputs); i++) {
+        inputs[i].fill(bench_codec_in, sizeof(bench_codec_in));
+
+        for (size_t j = 0; j < ARRAY_SIZE(codecs); j++) {
+            int len = 0;
+            uint64_t start = bench_clock_ns();
+            for (int r = 0; r < BENCH_CODEC_ROUNDS; r++) {
+                len = asdc_compress(codecs[j].codec, bench_codec_in, sizeof(bench_codec_in),
+                                    bench_codec_out, sizeof(bench_codec_out));
+            }
+            uint64_t encode_ns = (bench_clock_ns() - start) / BENCH_CODEC_ROUNDS;
+
+            if (len < 0) {
+                printk("%-7s %-5s %7zu  incompressible\n", inputs[i].name, codecs[j].name,
+                       sizeof(bench_codec_in));
+                continue;
+            }
+
+            int out = 0;
+            start = bench_clock_ns();
+            for (int r = 0; r < BENCH_CODEC_ROUNDS; r++) {
+                out = asdc_decompress(codecs[j].codec, bench_codec_out, len, bench_codec_check,
+                                      sizeof(bench_codec_check));
+            }
+            uint64_t decode_ns = (bench_clock_ns() - start) / BENCH_CODEC_ROUNDS;
+
+            if (out != sizeof(bench_codec_in) ||
+                memcmp(bench_codec_in, bench_codec_check, sizeof(bench_codec_in)) != 0) {
+                printk("%-7s %-5s round trip mismatch\n", inputs[i].name, codecs[j].name);
+                continue;
+            }
+
+            printk("%-7s %-5s %7zu %11d %11llu %11llu\n", inputs[i].name, codecs[j].name,
+                   sizeof(bench_codec_in), len, encode_ns, decode_ns);
+        }
+    }
+}
+#endif
+
+static void bench_recv(const struct device *dev, uint8_t peer, uint8_t *buf, size_t len)
+{
+    uint64_t now = bench_clock_ns();
+    struct bench_header hdr;
+
+    if (len < sizeof(hdr)) {
+        return;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    // late messages of an earlier run
+    if (hdr.run != bench.run) {
+        return;
+    }
+
+    if (bench.received < BENCH_MESSAGES) {
+        bench.latencies_ns[bench.received] = (uint32_t)MIN(now - hdr.sent_ns, UINT32_MAX);
+    }
+    bench.received++;
+    bench.rx_bytes += len;
+    bench.last_rx_ns = now;
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_run(const struct bench_params *p)
+{
+    uint32_t sent = 0;
+    uint32_t dropped = 0;
+
+    bench.run++;
+    bench.received = 0;
+    bench.rx_bytes = 0;
+
+    uint64_t start = bench_clock_ns();
+    bench.last_rx_ns = start;
+
+    for (uint32_t i = 0; i < BENCH_MESSAGES; i++) {
+        struct bench_header hdr = {
+            .run = bench.run,
+            .seq = i,
+            .sent_ns = bench_clock_ns(),
+        };
+        memcpy(bench_payload, &hdr, sizeof(hdr));
+
+        int ret = asdc_send(bench_channels[i % p->channels], bench_payload, p->payload, 0);
+        if (ret < 0) {
+            dropped++;
+        } else {
+            sent++;
+        }
+
+        if ((i + 1) % p->burst == 0) {
+            k_sleep(K_TICKS(1));
+        }
+    }
+
+    for (int waited = 0; bench.received < sent && waited < BENCH_DRAIN_TIMEOUT_MS; waited++) {
+        k_sleep(K_MSEC(1));
+    }
+
+    uint32_t received = bench.received;
+    uint64_t elapsed_ns = MAX(bench.last_rx_ns - start, 1);
+    uint64_t msgs_per_s = (uint64_t)received * NSEC_PER_SEC / elapsed_ns;
+    uint64_t bytes_per_s = bench.rx_bytes * NSEC_PER_SEC / elapsed_ns;
+
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    size_t samples = MIN(received, BENCH_MESSAGES);
+    if (samples > 0) {
+        qsort(bench.latencies_ns, samples, sizeof(bench.latencies_ns[0]), bench_cmp_u32);
+        p50 = bench.latencies_ns[samples / 2];
+        p99 = bench.latencies_ns[samples * 99 / 100];
+    }
+
+    // messages accepted by asdc_send() but never received count as dropped too
+    uint32_t lost = dropped + (sent - MIN(received, sent));
+
+    printk("%7zu %8zu %5zu %10llu %12llu %9u %9u %5u.%01u%%\n", p->payload, p->channels, p->burst,
+           msgs_per_s, bytes_per_s, p50, p99, lost * 100 / BENCH_MESSAGES,
+           (lost * 1000 / BENCH_MESSAGES) % 10);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(bench_channels); i++) {
+        if (!device_is_ready(bench_channels[i])) {
+            printk("asdc channel %s not ready\n", bench_channels[i]->name);
+            return -ENODEV;
+        }
+        asdc_register_recv_cb(bench_channels[i], bench_recv);
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+    bench_codecs();
+#endif
+
+    printk("asdc benchmark, %d messages per run\n", BENCH_MESSAGES);
+    printk("payload channels burst      msg/s      bytes/s   p50(ns)   p99(ns)  dropped\n");
+
+    for (size_t i = 0; i < ARRAY_SIZE(bench_payloads); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(bench_channel_counts); j++) {
+            for (size_t k = 0; k < ARRAY_SIZE(bench_bursts); k++) {
+                struct bench_params p = {
+                    .payload = bench_payloads[i],
+                    .channels = bench_channel_counts[j],
+                    .burst = bench_bursts[k],
+                };
+                bench_run(&p);
+            }
+        }
+    }
+
+    printk("asdc benchmark done\n");
+    return 0;
+}
@@ -12,8 +12,8 @@
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
-static void asdc_rx_callback(const struct device *dev, void* sender_conn, uint8_t *data, size_t len) {
-    LOG_INF("ASDC data received on device %s: len=%d", dev->name, len);
+static void asdc_rx_callback(const struct device *dev, uint8_t peer, uint8_t *data, size_t len) {
+    LOG_INF("ASDC data received on device %s from peer %d: len=%d", dev->name, peer, len);
     
     // Print data as string in chunks
     char buf[128];
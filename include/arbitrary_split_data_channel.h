@@ -4,32 +4,263 @@
 
 #include <zephyr/device.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
+
+// matches the order of the mode property in the devicetree binding
+enum asdc_channel_mode {
+    ASDC_MODE_FIRE_AND_FORGET,
+    ASDC_MODE_COALESCING,           // a new message replaces the queued one, only the latest is sent
+    ASDC_MODE_DELTA,                // only the bytes that changed since the previous message are sent
+};
+
+// matches the order of the rx-dispatch property in the devicetree binding
+enum asdc_rx_dispatch {
+    ASDC_RX_DISPATCH_WORKQUEUE,     // system workqueue, or the one set with asdc_set_rx_work_q()
+    ASDC_RX_DISPATCH_INLINE,        // in the context the transport received the data in
+    ASDC_RX_DISPATCH_THREAD,        // dedicated rx thread
+};
+
+struct asdc_retained_msg;
+struct asdc_pool_class;
+struct asdc_rx_event;
 
 // device config structure
 struct asdc_config {
     int channel_id;
+    int priority;                   // lower values are sent first
+    uint8_t l2cap_channel;          // index of the l2cap channel of the link it is sent over
+    enum asdc_channel_mode mode;
+    uint8_t tx_credits;             // messages allowed in flight per peer, 0 for no flow control
+    bool reliable;                  // lost messages are retransmitted, see the reliable property
+    bool compress;                  // payloads are compressed, see the compress property
+    uint8_t retain_count;           // messages replayed to reconnecting peers, 0 for none
+    uint8_t retain_key_size;        // leading bytes of a message that identify what it replaces
+    struct asdc_retained_msg *retained; // retain_count slots, oldest first
+    uint16_t snapshot_size;         // largest message of a delta channel
+    uint16_t max_payload_size;      // largest message, 0 for the largest pool block
+    struct asdc_pool_class *pool;   // tx packet blocks of its own, NULL to use the shared pool
+    uint8_t *snapshots;             // delta: the snapshot sent last, then the last one of each peer
+    struct k_msgq *tx_msgq;
+    enum asdc_rx_dispatch rx_dispatch;
+    struct k_msgq *rx_msgq;         // received messages waiting for the recv callback
 };
 
-// sender_conn can be used for identification of the connection the data came from
-typedef void (*asdc_rx_cb)(const struct device *dev, void* sender_conn, uint8_t *buf, size_t buflen);
+// Peers are numbered from 0 to ASDC_MAX_PEERS - 1. On the central the index of a peripheral stays
+// the same across reconnects, a peripheral only has the central as peer 0 and a wired half only
+// has the other half.
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) && defined(CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS) && \
+    !IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRED)
+#define ASDC_MAX_PEERS CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS
+#else
+#define ASDC_MAX_PEERS 1
+#endif
+
+// send to every connected peer
+#define ASDC_PEER_BROADCAST 0xFF
+
+// peer is the index of the peer the data came from, it can be passed to asdc_send_to to reply
+typedef void (*asdc_rx_cb)(const struct device *dev, uint8_t peer, uint8_t *buf, size_t buflen);
+
+// Called for every message of a channel that matches the subscriber's filter. The buffer is shared
+// with the other subscribers and must not be modified.
+typedef void (*asdc_sub_cb)(const struct device *dev, uint8_t peer, const uint8_t *buf, size_t buflen,
+                            void *user_data);
+
+// any message type, see asdc_subscriber.type
+#define ASDC_SUB_TYPE_ANY -1
+
+// One of the local consumers of a channel, owned by the caller and registered with
+// asdc_subscribe(). A message is received over the air once and passed to every subscriber.
+struct asdc_subscriber {
+    sys_snode_t node;
+    asdc_sub_cb cb;
+    int16_t type;                   // first payload byte of the messages wanted, or ASDC_SUB_TYPE_ANY
+    void *user_data;
+};
 
 typedef int (*asdc_tx)(const struct device *dev, const uint8_t *data, size_t len, uint32_t delay_ms);
+typedef int (*asdc_tx_to)(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, uint32_t delay_ms);
 typedef void (*asdc_register_rx_cb)(const struct device *dev, asdc_rx_cb cb);
 
+// called from the asdc workqueue once a channel that rejected a message has room again
+typedef void (*asdc_tx_ready_cb)(const struct device *dev);
+
+typedef int (*asdc_tx_timeout)(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, k_timeout_t timeout);
+typedef void (*asdc_register_tx_ready)(const struct device *dev, asdc_tx_ready_cb cb);
+
+// writable payload area inside a transport buffer, see asdc_tx_reserve
+struct asdc_tx_span {
+    uint8_t *data;
+    size_t len;                     // may be lowered before committing
+    uint8_t peer;                   // ASDC_PEER_BROADCAST unless changed before committing
+    void *handle;
+};
+
+typedef int (*asdc_reserve_tx)(const struct device *dev, size_t len, struct asdc_tx_span *span);
+typedef int (*asdc_commit_tx)(const struct device *dev, struct asdc_tx_span *span, uint32_t delay_ms);
+typedef void (*asdc_abort_tx)(const struct device *dev, struct asdc_tx_span *span);
+
+// bucket 0 of the latency histogram counts latencies below 1us, bucket i those from 2^(i-1)us up
+// to 2^i us, the last bucket everything above
+#define ASDC_STATS_LATENCY_BUCKETS 20
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+struct asdc_counters {
+    atomic_t tx_messages;
+    atomic_t tx_bytes;
+    atomic_t tx_dropped;
+    atomic_t tx_mtu_rejects;
+    atomic_t tx_alloc_failures;
+    atomic_t tx_max_queue_depth;
+    atomic_t tx_latency[ASDC_STATS_LATENCY_BUCKETS];
+    atomic_t tx_retransmits;
+    atomic_t rx_messages;
+    atomic_t rx_bytes;
+    atomic_t rx_dropped;
+    atomic_t rx_alloc_failures;
+    atomic_t rx_duplicates;
+};
+#endif
+
+// credit window of a channel towards one peer, see the tx-credits devicetree property
+struct asdc_credit_state {
+    uint8_t tx_seq;                 // sequence number of the last message sent
+    uint8_t tx_acked;               // last sequence number the peer reported as consumed
+    uint8_t rx_seq;                 // sequence number of the last message consumed from the peer
+    uint8_t rx_reported;            // last rx_seq reported back to the peer
+    int64_t tx_progress_at;         // uptime of the last credit report, to recover lost ones
+};
+
+// retained messages of a channel, see the retain-count devicetree property
+struct asdc_retain_state {
+    uint8_t used;                   // slots of asdc_config.retained in use
+    uint8_t replay_next[ASDC_MAX_PEERS]; // next slot to replay to each peer
+    uint8_t replay_end[ASDC_MAX_PEERS];  // slot at which the replay to each peer stops
+};
+
+// snapshots of a channel in delta mode, see the mode devicetree property
+struct asdc_delta_state {
+    uint16_t tx_len;                // length of the snapshot sent last, 0 before the first one
+    uint8_t tx_gen;                 // generation of the snapshot sent last
+    bool tx_push[ASDC_MAX_PEERS];   // the peer needs the full snapshot
+    uint16_t rx_len[ASDC_MAX_PEERS];
+    uint8_t rx_gen[ASDC_MAX_PEERS];
+    bool rx_valid[ASDC_MAX_PEERS];  // false until a full snapshot arrived from the peer
+    bool rx_resync[ASDC_MAX_PEERS]; // a full snapshot still has to be requested from the peer
+    int64_t rx_resync_at[ASDC_MAX_PEERS]; // uptime of the last request, or of the connection
+};
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+#define ASDC_RELIABLE_WINDOW CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE_MAX_WINDOW
+
+// retransmission and reordering state of a reliable channel towards one peer, the sequence
+// numbers are the ones of the credit window
+struct asdc_reliable_state {
+    uint8_t *tx_packets[ASDC_RELIABLE_WINDOW]; // sent packets not acknowledged yet, by seq
+    uint32_t tx_sent_at[ASDC_RELIABLE_WINDOW]; // uptime in ms of their last transmission
+    uint16_t tx_order[ASDC_RELIABLE_WINDOW];   // tx_count at their last transmission
+    uint16_t tx_count;              // transmissions so far, to tell which packet went out first
+    uint32_t tx_sacked;             // bit n is set if the peer holds tx_acked + 2 + n
+    uint8_t tx_acked;               // last sequence number the peer received in order
+    uint8_t tx_sent;                // last sequence number sent
+    bool tx_synced;                 // the peer told us what it expects since it connected
+    bool sync_pending;              // our rx state still has to be sent to the peer
+    uint8_t *rx_held[ASDC_RELIABLE_WINDOW]; // pool blocks received ahead of rx_expected, by seq
+    uint16_t rx_held_len[ASDC_RELIABLE_WINDOW];
+    uint8_t rx_expected;            // next sequence number to pass on in order
+    bool rx_synced;                 // false until the first message, rx_expected is unknown
+    bool ack_pending;
+};
+#endif
+
 // device runtime data structure
 struct asdc_data {
+    const struct device *dev;
     asdc_rx_cb recv_cb;
+    sys_slist_t subscribers;        // struct asdc_subscriber, called after recv_cb
+    struct k_mutex sub_lock;        // guards subscribers, held while they are called
+    struct asdc_subscriber *sub_next; // subscriber the delivery in progress calls next
+    struct k_work rx_work;          // passes the messages of rx_msgq to the consumers
+    struct k_work_q *rx_work_q;     // queue rx_work runs on, NULL for the default one
+    struct asdc_rx_event *rx_current; // message the consumers are called with, NULL outside of them
+    void *rx_current_held;          // handle of rx_current once a consumer held it
+    asdc_tx_ready_cb tx_ready_cb;
+    struct k_sem tx_space;          // given whenever queue space or credits free up
+    atomic_t tx_blocked;            // set when a message was rejected, until tx_ready_cb ran
+    struct asdc_credit_state credits[ASDC_MAX_PEERS];
+    struct asdc_retain_state retain;
+    struct asdc_delta_state delta;
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    struct asdc_reliable_state reliable[ASDC_MAX_PEERS];
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+    struct asdc_counters counters;
+#endif
 };
 
+// per-channel counters, byte counts are payload bytes
+struct asdc_stats {
+    uint32_t tx_messages;           // messages handed to the transport
+    uint32_t tx_bytes;
+    uint32_t tx_dropped;            // messages rejected because the channel's tx queue was full,
+                                    // or lost with a batch the transport failed to send
+    uint32_t tx_mtu_rejects;        // messages larger than the pool blocks or the transport MTU
+    uint32_t tx_alloc_failures;
+    uint32_t tx_max_queue_depth;    // high-water mark of the channel's tx queue
+    uint32_t tx_latency[ASDC_STATS_LATENCY_BUCKETS]; // time from queueing to the transport
+    uint32_t tx_retransmits;        // messages of reliable channels sent again, or queued again
+                                    // after a failed batch
+    uint32_t rx_messages;           // messages passed to the recv callback
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;            // rx queue full or no recv callback registered
+    uint32_t rx_alloc_failures;
+    uint32_t rx_duplicates;         // retransmitted messages of reliable channels received twice
+};
+
+// returns -ENOTSUP without CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS
+int asdc_get_stats(const struct device *dev, struct asdc_stats *stats);
+void asdc_reset_stats(const struct device *dev);
+
+// A queued packet. The channel_id used to be 32 bits wide, on little-endian targets this is the
+// legacy header sent by older versions of this module, peers that read the compact one get that
+// instead, see CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER.
 struct asdc_packet {
-    uint32_t channel_id;
+    uint16_t channel_id;
+    uint8_t flags;
+    uint8_t seq;                    // sequence number on channels with tx-credits, 0 otherwise
     uint32_t len;
     uint8_t data[];
 } __packed;
 
+// data starts with a fragment header, see CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION
+#define ASDC_PACKET_FLAG_FRAGMENT BIT(0)
+// data is a message between the two asdc modules, never passed to the recv callback
+#define ASDC_PACKET_FLAG_CONTROL BIT(1)
+// enum asdc_codec the data is compressed with, see the compress devicetree property
+#define ASDC_PACKET_FLAG_CODEC_SHIFT 2
+#define ASDC_PACKET_FLAG_CODEC_MASK (BIT(2) | BIT(3))
+
+enum asdc_codec {
+    ASDC_CODEC_NONE,
+    ASDC_CODEC_LZF,                 // LZ77 variant in the format of liblzf
+    ASDC_CODEC_RLE,                 // run-length encoding
+};
+
+// Payload codecs used for compressed channels, exposed for benchmarking them. Return the number
+// of bytes written to out, -ENOSPC if the compressed data does not fit in out_len or -EINVAL if
+// in is not valid compressed data.
+int asdc_compress(enum asdc_codec codec, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+int asdc_decompress(enum asdc_codec codec, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
 __subsystem struct asdc_driver_api {
     asdc_tx send;
+    asdc_tx_to send_to;
+    asdc_tx_timeout send_timeout;
+    asdc_register_tx_ready register_tx_ready_cb;
     asdc_register_rx_cb register_recv_cb;
+    asdc_reserve_tx tx_reserve;
+    asdc_commit_tx tx_commit;
+    asdc_abort_tx tx_abort;
 };
 
 __syscall int asdc_send(const struct device *dev, const uint8_t *data, size_t len, uint32_t delay_ms);
@@ -43,6 +274,18 @@ static inline int z_impl_asdc_send(const struct device *dev, const uint8_t *data
 	return api->send(dev, data, len, delay_ms);
 }
 
+// like asdc_send, but only sends to the given peer
+__syscall int asdc_send_to(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, uint32_t delay_ms);
+
+static inline int z_impl_asdc_send_to(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, uint32_t delay_ms)
+{
+    const struct asdc_driver_api *api = (const struct asdc_driver_api *)dev->api;
+	if (api->send_to == NULL) {
+		return -ENOSYS;
+	}
+	return api->send_to(dev, peer, data, len, delay_ms);
+}
+
 __syscall void asdc_register_recv_cb(const struct device *dev, asdc_rx_cb cb);
 
 static inline void z_impl_asdc_register_recv_cb(const struct device *dev, asdc_rx_cb cb)
@@ -54,7 +297,132 @@ static inline void z_impl_asdc_register_recv_cb(const struct device *dev, asdc_r
 	api->register_recv_cb(dev, cb);
 }
 
-void asdc_on_data_received(void* conn, uint8_t *data, size_t len);
+// Like asdc_send_to, but waits up to timeout for room in the channel's queue and, with tx-credits,
+// for a credit of the peer instead of dropping the message. Returns -EAGAIN if there was no room
+// in time, with K_NO_WAIT that is a non-blocking attempt which never drops.
+__syscall int asdc_send_timeout(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, k_timeout_t timeout);
+
+static inline int z_impl_asdc_send_timeout(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, k_timeout_t timeout)
+{
+    const struct asdc_driver_api *api = (const struct asdc_driver_api *)dev->api;
+	if (api->send_timeout == NULL) {
+		return -ENOSYS;
+	}
+	return api->send_timeout(dev, peer, data, len, timeout);
+}
+
+// cb is called once the channel has room again after a send was rejected or dropped
+__syscall void asdc_register_tx_ready_cb(const struct device *dev, asdc_tx_ready_cb cb);
+
+static inline void z_impl_asdc_register_tx_ready_cb(const struct device *dev, asdc_tx_ready_cb cb)
+{
+    const struct asdc_driver_api *api = (const struct asdc_driver_api *)dev->api;
+	if (api->register_tx_ready_cb == NULL) {
+		return;
+	}
+	api->register_tx_ready_cb(dev, cb);
+}
+
+// Reserves len bytes of payload directly in a transport buffer, with the packet header already
+// in place, so that the payload can be written without any intermediate copy. The span must be
+// handed to asdc_tx_commit() to queue it or asdc_tx_abort() to drop it. Does not block, returns
+// -ENOBUFS if no transport buffer is free and -ENOTSUP on reliable and delta channels.
+__syscall int asdc_tx_reserve(const struct device *dev, size_t len, struct asdc_tx_span *span);
+
+static inline int z_impl_asdc_tx_reserve(const struct device *dev, size_t len, struct asdc_tx_span *span)
+{
+    const struct asdc_driver_api *api = (const struct asdc_driver_api *)dev->api;
+	if (api->tx_reserve == NULL) {
+		return -ENOSYS;
+	}
+	return api->tx_reserve(dev, len, span);
+}
+
+__syscall int asdc_tx_commit(const struct device *dev, struct asdc_tx_span *span, uint32_t delay_ms);
+
+static inline int z_impl_asdc_tx_commit(const struct device *dev, struct asdc_tx_span *span, uint32_t delay_ms)
+{
+    const struct asdc_driver_api *api = (const struct asdc_driver_api *)dev->api;
+	if (api->tx_commit == NULL) {
+		return -ENOSYS;
+	}
+	return api->tx_commit(dev, span, delay_ms);
+}
+
+__syscall void asdc_tx_abort(const struct device *dev, struct asdc_tx_span *span);
+
+static inline void z_impl_asdc_tx_abort(const struct device *dev, struct asdc_tx_span *span)
+{
+    const struct asdc_driver_api *api = (const struct asdc_driver_api *)dev->api;
+	if (api->tx_abort == NULL) {
+		return;
+	}
+	api->tx_abort(dev, span);
+}
+
+void asdc_on_data_received(uint8_t peer, uint8_t *data, size_t len);
+
+// called by the transport when the link to a peer came up or went down
+void asdc_on_peer_connected(uint8_t peer);
+void asdc_on_peer_disconnected(uint8_t peer);
+
+// called by the transport whenever buffers or credits became available again
+void asdc_on_tx_ready(void);
+
+struct net_buf;
+
+// Zero-copy variant of asdc_on_data_received for CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_ZERO_COPY.
+// Returns -EINPROGRESS if the channel took over the reference to buf, it is given back to the
+// transport with asdc_transport_rx_release(rx_ctx, buf) once the recv callback is done with it.
+int asdc_on_data_received_buf(uint8_t peer, void *rx_ctx, struct net_buf *buf);
+
+// Adds a subscriber to the channel, in addition to the recv callback. Subscribers are called in
+// the order they subscribed, from the context given by rx-dispatch. They may subscribe and
+// unsubscribe any subscriber from inside their callback, one removed before its turn is not called
+// with the message. -EALREADY if sub is already subscribed.
+int asdc_subscribe(const struct device *dev, struct asdc_subscriber *sub);
+// -ENOENT if sub was not subscribed to the channel
+int asdc_unsubscribe(const struct device *dev, struct asdc_subscriber *sub);
+
+// Keeps the buffer passed to an asdc_rx_cb or asdc_sub_cb valid after the callback returns. Must
+// be called from inside the callback, the returned handle has to be passed to asdc_rx_release()
+// later. Several consumers of a message may hold it, it is released once all of them did.
+// Returns NULL if all CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_MAX_HELD slots are in use.
+void *asdc_rx_hold(const struct device *dev);
+void asdc_rx_release(void *handle);
+
+// Runs the recv callback of a channel with rx-dispatch = "workqueue" on work_q instead of the
+// system workqueue, NULL goes back to it. Set it before data arrives, messages already queued
+// may still be passed on from the previous queue. -ENOTSUP for other rx-dispatch policies.
+int asdc_set_rx_work_q(const struct device *dev, struct k_work_q *work_q);
+
+// usage statistics of one size class of the packet pool
+struct asdc_pool_stats {
+    size_t block_size;
+    uint32_t num_blocks;
+    uint32_t num_used;
+    uint32_t max_used;          // high-water mark of num_used
+    uint32_t alloc_failures;
+};
+
+// size classes are numbered from smallest to largest, returns -ENOENT past the last one
+int asdc_pool_get_stats(size_t size_class, struct asdc_pool_stats *stats);
+// blocks of a channel with max-payload-size, -ENOENT if it uses the shared pool
+int asdc_pool_get_channel_stats(const struct device *dev, struct asdc_pool_stats *stats);
+
+// state of the BLE link manager, see CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_MANAGER
+struct asdc_link_stats {
+    bool bulk;                  // the bulk connection parameters are in use
+    uint32_t queued;            // messages queued at the last sample
+    uint32_t bytes_per_sec;     // tx rate over the last sample period
+    uint32_t bulk_switches;     // times the link switched to the bulk parameters
+    uint32_t idle_switches;     // times it switched back to the idle parameters
+    uint32_t update_requests;   // parameter, PHY and data length requests made
+    uint32_t update_failures;   // requests the stack refused
+};
+
+// -ENOTSUP unless the link manager is enabled
+int asdc_link_get_stats(struct asdc_link_stats *stats);
 
 #include <syscalls/arbitrary_split_data_channel.h>
 
@@ -0,0 +1,235 @@
+#ifndef ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_SCHEMA_H_
+#define ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_SCHEMA_H_
+
+// Typed messages with a compact wire format that does not depend on the struct layout, the
+// endianness or the word size of either half. A message is declared once with its fields as an
+// X-macro list of (kind, name) pairs:
+//
+//     #define BATTERY_MSG_FIELDS(F) F(U8, source) F(U8, level) F(I16, mv_delta) F(BOOL, charging)
+//
+//     ASDC_SCHEMA_DEFINE(battery_msg, 0x01, 1, BATTERY_MSG_FIELDS)
+//
+// which gives struct battery_msg, battery_msg_encode(), battery_msg_decode() and the constant
+// battery_msg_max_size.
+//
+// On the wire a message is its type byte, its version byte and then the fields in order. Integers
+// are base-128 varints, least significant group first, signed ones zigzag encoded first so small
+// negative values stay short. BOOL is a single byte. BYTES is a varint length followed by the
+// bytes, it decodes to a view into the received buffer, valid as long as that buffer is.
+//
+// The type byte is the first payload byte, so asdc_subscriber.type can filter on it. To stay
+// compatible, a new version of a message only appends fields: a decoder ignores fields it does
+// not know, and fields missing from an older sender's message decode as zero. Anything else needs
+// a new type.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/toolchain.h>
+#include <zephyr/sys/util.h>
+
+// byte string field, see the BYTES kind
+struct asdc_schema_bytes {
+    const uint8_t *data;
+    size_t len;
+};
+
+// type and version byte
+#define ASDC_SCHEMA_HEADER_SIZE 2
+
+// Varint primitives the generated code is built on. They advance *pos and return false if the
+// value does not fit before end, or does not decode.
+bool asdc_schema_put_uint(uint8_t **pos, const uint8_t *end, uint64_t v);
+bool asdc_schema_get_uint(const uint8_t **pos, const uint8_t *end, uint64_t *v);
+bool asdc_schema_put_int(uint8_t **pos, const uint8_t *end, int64_t v);
+bool asdc_schema_get_int(const uint8_t **pos, const uint8_t *end, int64_t *v);
+bool asdc_schema_put_bytes(uint8_t **pos, const uint8_t *end, const struct asdc_schema_bytes *v);
+bool asdc_schema_get_bytes(const uint8_t **pos, const uint8_t *end, struct asdc_schema_bytes *v);
+
+// typed accessors, values out of range of the field fail to decode
+#define ASDC_SCHEMA_UINT_ACCESSORS(name, ctype, max)                            \
+    static inline bool asdc_schema_put_##name(uint8_t **pos,                    \
+                                              const uint8_t *end, ctype v)      \
+    {                                                                           \
+        return asdc_schema_put_uint(pos, end, v);                               \
+    }                                                                           \
+    static inline bool asdc_schema_get_##name(const uint8_t **pos,              \
+                                              const uint8_t *end, ctype *v)     \
+    {                                                                           \
+        uint64_t u;                                                             \
+        if (!asdc_schema_get_uint(pos, end, &u) || u > (max)) {                 \
+            return false;                                                       \
+        }                                                                       \
+        *v = (ctype)u;                                                          \
+        return true;                                                            \
+    }
+
+#define ASDC_SCHEMA_INT_ACCESSORS(name, ctype, min, max)                        \
+    static inline bool asdc_schema_put_##name(uint8_t **pos,                    \
+                                              const uint8_t *end, ctype v)      \
+    {                                                                           \
+        return asdc_schema_put_int(pos, end, v);                                \
+    }                                                                           \
+    static inline bool asdc_schema_get_##name(const uint8_t **pos,              \
+                                              const uint8_t *end, ctype *v)     \
+    {                                                                           \
+        int64_t i;                                                              \
+        if (!asdc_schema_get_int(pos, end, &i) || i < (min) || i > (max)) {     \
+            return false;                                                       \
+        }                                                                       \
+        *v = (ctype)i;                                                          \
+        return true;                                                            \
+    }
+
+ASDC_SCHEMA_UINT_ACCESSORS(u8, uint8_t, UINT8_MAX)
+ASDC_SCHEMA_UINT_ACCESSORS(u16, uint16_t, UINT16_MAX)
+ASDC_SCHEMA_UINT_ACCESSORS(u32, uint32_t, UINT32_MAX)
+ASDC_SCHEMA_INT_ACCESSORS(i8, int8_t, INT8_MIN, INT8_MAX)
+ASDC_SCHEMA_INT_ACCESSORS(i16, int16_t, INT16_MIN, INT16_MAX)
+ASDC_SCHEMA_INT_ACCESSORS(i32, int32_t, INT32_MIN, INT32_MAX)
+
+// 64 bit fields take any value that decodes
+static inline bool asdc_schema_put_u64(uint8_t **pos, const uint8_t *end, uint64_t v)
+{
+    return asdc_schema_put_uint(pos, end, v);
+}
+
+static inline bool asdc_schema_get_u64(const uint8_t **pos, const uint8_t *end, uint64_t *v)
+{
+    return asdc_schema_get_uint(pos, end, v);
+}
+
+static inline bool asdc_schema_put_i64(uint8_t **pos, const uint8_t *end, int64_t v)
+{
+    return asdc_schema_put_int(pos, end, v);
+}
+
+static inline bool asdc_schema_get_i64(const uint8_t **pos, const uint8_t *end, int64_t *v)
+{
+    return asdc_schema_get_int(pos, end, v);
+}
+
+static inline bool asdc_schema_put_bool(uint8_t **pos, const uint8_t *end, bool v)
+{
+    return asdc_schema_put_uint(pos, end, v ? 1 : 0);
+}
+
+static inline bool asdc_schema_get_bool(const uint8_t **pos, const uint8_t *end, bool *v)
+{
+    uint8_t u;
+    if (!asdc_schema_get_u8(pos, end, &u) || u > 1) {
+        return false;
+    }
+    *v = u;
+    return true;
+}
+
+// C type, largest encoded size and accessors of each field kind
+#define ASDC_SCHEMA_CTYPE_U8 uint8_t
+#define ASDC_SCHEMA_CTYPE_U16 uint16_t
+#define ASDC_SCHEMA_CTYPE_U32 uint32_t
+#define ASDC_SCHEMA_CTYPE_U64 uint64_t
+#define ASDC_SCHEMA_CTYPE_I8 int8_t
+#define ASDC_SCHEMA_CTYPE_I16 int16_t
+#define ASDC_SCHEMA_CTYPE_I32 int32_t
+#define ASDC_SCHEMA_CTYPE_I64 int64_t
+#define ASDC_SCHEMA_CTYPE_BOOL bool
+#define ASDC_SCHEMA_CTYPE_BYTES struct asdc_schema_bytes
+
+// BYTES only counts its length prefix, the bytes themselves come on top
+#define ASDC_SCHEMA_MAXLEN_U8 2
+#define ASDC_SCHEMA_MAXLEN_U16 3
+#define ASDC_SCHEMA_MAXLEN_U32 5
+#define ASDC_SCHEMA_MAXLEN_U64 10
+#define ASDC_SCHEMA_MAXLEN_I8 2
+#define ASDC_SCHEMA_MAXLEN_I16 3
+#define ASDC_SCHEMA_MAXLEN_I32 5
+#define ASDC_SCHEMA_MAXLEN_I64 10
+#define ASDC_SCHEMA_MAXLEN_BOOL 1
+#define ASDC_SCHEMA_MAXLEN_BYTES 5
+
+#define ASDC_SCHEMA_PUT_U8 asdc_schema_put_u8
+#define ASDC_SCHEMA_PUT_U16 asdc_schema_put_u16
+#define ASDC_SCHEMA_PUT_U32 asdc_schema_put_u32
+#define ASDC_SCHEMA_PUT_U64 asdc_schema_put_u64
+#define ASDC_SCHEMA_PUT_I8 asdc_schema_put_i8
+#define ASDC_SCHEMA_PUT_I16 asdc_schema_put_i16
+#define ASDC_SCHEMA_PUT_I32 asdc_schema_put_i32
+#define ASDC_SCHEMA_PUT_I64 asdc_schema_put_i64
+#define ASDC_SCHEMA_PUT_BOOL asdc_schema_put_bool
+#define ASDC_SCHEMA_PUT_BYTES(pos, end, v) asdc_schema_put_bytes(pos, end, &(v))
+
+#define ASDC_SCHEMA_GET_U8 asdc_schema_get_u8
+#define ASDC_SCHEMA_GET_U16 asdc_schema_get_u16
+#define ASDC_SCHEMA_GET_U32 asdc_schema_get_u32
+#define ASDC_SCHEMA_GET_U64 asdc_schema_get_u64
+#define ASDC_SCHEMA_GET_I8 asdc_schema_get_i8
+#define ASDC_SCHEMA_GET_I16 asdc_schema_get_i16
+#define ASDC_SCHEMA_GET_I32 asdc_schema_get_i32
+#define ASDC_SCHEMA_GET_I64 asdc_schema_get_i64
+#define ASDC_SCHEMA_GET_BOOL asdc_schema_get_bool
+#define ASDC_SCHEMA_GET_BYTES asdc_schema_get_bytes
+
+#define ASDC_SCHEMA_MEMBER(kind, field) ASDC_SCHEMA_CTYPE_##kind field;
+#define ASDC_SCHEMA_FIELD_MAXLEN(kind, field) + ASDC_SCHEMA_MAXLEN_##kind
+#define ASDC_SCHEMA_ENCODE_FIELD(kind, field)                                   \
+    if (!ASDC_SCHEMA_PUT_##kind(&pos, end, msg->field)) {                       \
+        return -ENOSPC;                                                         \
+    }
+// a field the sender's version did not have yet stays zero
+#define ASDC_SCHEMA_DECODE_FIELD(kind, field)                                   \
+    if (pos < end && !ASDC_SCHEMA_GET_##kind(&pos, end, &msg->field)) {         \
+        return -EBADMSG;                                                        \
+    }
+
+// Defines struct name with the fields listed by fields and its (de)serializers:
+//
+// name##_encode() writes msg to buf and returns the encoded length, -ENOSPC if it needs more than
+// size bytes.
+// name##_decode() fills msg from a received message and returns the sender's version of it,
+// -ENOMSG if the message has another type and -EBADMSG if it is malformed.
+// name##_max_size is the largest encoded size, not counting the bytes of BYTES fields.
+#define ASDC_SCHEMA_DEFINE(name, type, version, fields)                         \
+    BUILD_ASSERT((type) >= 0 && (type) <= UINT8_MAX, "type must fit a byte");   \
+    BUILD_ASSERT((version) >= 0 && (version) <= UINT8_MAX,                      \
+                 "version must fit a byte");                                    \
+    struct name {                                                               \
+        fields(ASDC_SCHEMA_MEMBER)                                              \
+    };                                                                          \
+    enum {                                                                      \
+        name##_max_size = ASDC_SCHEMA_HEADER_SIZE                               \
+                          fields(ASDC_SCHEMA_FIELD_MAXLEN)                      \
+    };                                                                          \
+    static inline int name##_encode(const struct name *msg, uint8_t *buf,       \
+                                    size_t size)                                \
+    {                                                                           \
+        uint8_t *pos = buf;                                                     \
+        const uint8_t *end = buf + size;                                        \
+        if (size < ASDC_SCHEMA_HEADER_SIZE) {                                   \
+            return -ENOSPC;                                                     \
+        }                                                                       \
+        *pos++ = (type);                                                        \
+        *pos++ = (version);                                                     \
+        fields(ASDC_SCHEMA_ENCODE_FIELD)                                        \
+        return pos - buf;                                                       \
+    }                                                                           \
+    static inline int name##_decode(struct name *msg, const uint8_t *buf,       \
+                                    size_t len)                                 \
+    {                                                                           \
+        const uint8_t *pos = buf + ASDC_SCHEMA_HEADER_SIZE;                     \
+        const uint8_t *end = buf + len;                                         \
+        if (len < ASDC_SCHEMA_HEADER_SIZE) {                                    \
+            return -EBADMSG;                                                    \
+        }                                                                       \
+        if (buf[0] != (type)) {                                                 \
+            return -ENOMSG;                                                     \
+        }                                                                       \
+        memset(msg, 0, sizeof(*msg));                                           \
+        fields(ASDC_SCHEMA_DECODE_FIELD)                                        \
+        return buf[1];                                                          \
+    }
+
+#endif // ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_SCHEMA_H_
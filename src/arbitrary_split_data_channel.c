@@ -9,9 +9,12 @@
 #include <sys/types.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/device.h>
-#include <stdlib.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/byteorder.h>
 
 #include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
 
 #include <zephyr/logging/log.h>
 
@@ -19,135 +22,1495 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 struct asdc_tx_event {
     const struct device *dev;
+    uint8_t peer;                   // peer index or ASDC_PEER_BROADCAST
     size_t len;
-    uint8_t *data;
+    uint8_t *data;                  // pool block holding the packet
+    struct net_buf *buf;            // transport buffer holding the packet instead of data
+    bool control;                   // control message, not counted as channel traffic
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION)
+    struct asdc_frag_state frag;    // fragments sent before the transport ran out of buffers
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCHING)
+    bool requeued;                  // queued again after its batch failed, only done once
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+    uint32_t queued_at;             // cycle count when queued, for the latency histogram
+#endif
 };
 
 struct asdc_rx_event {
     const struct device *dev;
-    void* conn;                     // this is void* in order to match the split transport connection type used (BLE, wired, etc...).
+    uint8_t peer;                   // index of the peer the data came from
+    uint8_t seq;                    // sequence number, reported back on channels with tx-credits
     size_t len;
-    uint8_t *data;
+    uint8_t *data;                  // pool block, or a view into buf in zero-copy mode
+    struct net_buf *buf;            // only set in zero-copy mode
+    void *rx_ctx;                   // transport context needed to release buf
 };
 
-int asdc_transport_init(const struct device *dev);
-void asdc_transport_send_data(const struct device *dev, const uint8_t *data, size_t len);
+// control messages, sent ahead of every channel
+K_MSGQ_DEFINE(asdc_ctrl_msgq, sizeof(struct asdc_tx_event),
+              CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_CONTROL_QUEUE_SIZE, 1);
 
-K_MSGQ_DEFINE(asdc_tx_msgq, sizeof(struct asdc_tx_event),
-              CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE, 1);
-K_MSGQ_DEFINE(asdc_rx_msgq, sizeof(struct asdc_rx_event),
-              CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_QUEUE_SIZE, 1);
+// bit n is set while peer n is connected
+static atomic_t asdc_peers_connected;
+
+// bytes handed to the transport, control messages included, for the link manager
+static atomic_t asdc_tx_bytes;
+
+K_THREAD_STACK_DEFINE(asdc_work_q_stack, CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WORKQUEUE_STACK_SIZE);
+
+struct k_work_q asdc_work_q;
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD)
+K_THREAD_STACK_DEFINE(asdc_rx_work_q_stack, CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD_STACK_SIZE);
+
+// runs the recv callbacks of channels with rx-dispatch = "thread"
+static struct k_work_q asdc_rx_work_q;
+#endif
+
+//
+// Per-channel statistics
+//
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+static void asdc_stats_queued(const struct device *dev, struct k_msgq *msgq)
+{
+    struct asdc_counters *c = &((struct asdc_data *)dev->data)->counters;
+    atomic_val_t depth = k_msgq_num_used_get(msgq);
+    atomic_val_t max = atomic_get(&c->tx_max_queue_depth);
+
+    while (depth > max && !atomic_cas(&c->tx_max_queue_depth, max, depth)) {
+        max = atomic_get(&c->tx_max_queue_depth);
+    }
+}
+
+static void asdc_stats_sent(const struct asdc_tx_event *ev)
+{
+    struct asdc_counters *c = &((struct asdc_data *)ev->dev->data)->counters;
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - ev->queued_at);
+    size_t bucket = MIN(us ? 32 - __builtin_clz(us) : 0, ASDC_STATS_LATENCY_BUCKETS - 1);
+
+    atomic_inc(&c->tx_messages);
+    atomic_add(&c->tx_bytes, ev->len - sizeof(struct asdc_packet));
+    atomic_inc(&c->tx_latency[bucket]);
+}
+#else
+static inline void asdc_stats_queued(const struct device *dev, struct k_msgq *msgq) {}
+static inline void asdc_stats_sent(const struct asdc_tx_event *ev) {}
+#endif
+
+static int asdc_tx_send_packet(struct asdc_tx_event *ev)
+{
+    const uint8_t version = asdc_tx_wire_version(ev->peer);
+    const struct asdc_wire_packet packet = asdc_wire_packet_of((const struct asdc_packet *)ev->data);
+    const size_t header_len = asdc_wire_header_size(&packet, version, false);
+
+    size_t mtu = asdc_transport_get_mtu(ev->dev, ev->peer);
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION)
+    // a message partly sent as fragments is finished as fragments, whatever the mtu is now
+    if (header_len + packet.len > mtu || ev->frag.offset > 0) {
+        int err = asdc_frag_send(ev->dev, ev->peer, (const struct asdc_packet *)ev->data, mtu,
+                                 &ev->frag);
+        if (err < 0 && err != -ENOBUFS) {
+            LOG_ERR("Failed to send fragmented asdc data on device %s: %d", ev->dev->name, err);
+        }
+        return err;
+    }
+#else
+    if (header_len + packet.len > mtu) {
+        // the transport could never allocate a buffer for it, retrying would stall the queue
+        return -EMSGSIZE;
+    }
+#endif
+
+    // the pool block is laid out with the legacy header
+    if (version == ASDC_WIRE_VERSION_LEGACY) {
+        return asdc_transport_send_data(ev->dev, ev->peer, ev->data, ev->len);
+    }
+
+    struct net_buf *buf = asdc_transport_alloc_buf(ev->dev, header_len + packet.len, K_NO_WAIT);
+    if (!buf) {
+        return -ENOBUFS;
+    }
+    asdc_wire_put_header(net_buf_add(buf, header_len), &packet, version, false);
+    net_buf_add_mem(buf, packet.data, packet.len);
+    int err = asdc_transport_send_buf(ev->dev, ev->peer, buf);
+    if (err == -ENOBUFS) {
+        // rebuilt from the pool block on the retry, the peer may want another header by then
+        net_buf_unref(buf);
+    }
+    return err;
+}
+
+// the pool block of ev was handed to the transport, or could not be sent at all
+static void asdc_tx_packet_done(const struct asdc_tx_event *ev)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    if (!ev->control && ((const struct asdc_config *)ev->dev->config)->reliable) {
+        // kept until acknowledged, also when the peer was not connected to receive it
+        asdc_reliable_sent(ev->dev, ev->peer, ev->data);
+        return;
+    }
+#endif
+    asdc_pool_free(ev->data);
+}
+
+// Hands the packet of ev to the transport. Returns -ENOBUFS if the transport is out of buffers,
+// the caller then still owns ev, otherwise ev is consumed.
+static int asdc_tx_send_event(struct asdc_tx_event *ev)
+{
+    ASDC_TRACE("tx_send", ((const struct asdc_config *)ev->dev->config)->channel_id, ev->len);
+
+    int err;
+    if (ev->buf) {
+        // Sent as built, with the legacy header, which every peer reads. On -ENOBUFS the
+        // transport left it untouched and ev keeps it for the retry.
+        err = asdc_transport_send_buf(ev->dev, ev->peer, ev->buf);
+    } else {
+        err = asdc_tx_send_packet(ev);
+        if (err != -ENOBUFS) {
+            asdc_tx_packet_done(ev);
+        }
+    }
+
+    if (ev->control) {
+        return err;
+    }
+
+    if (err == 0) {
+        asdc_stats_sent(ev);
+    } else if (err == -EMSGSIZE) {
+        ASDC_STAT_INC(ev->dev, tx_mtu_rejects);
+    }
+    return err;
+}
+
+// every channel instance, in devicetree order
+#define ASDC_CHANNEL_DEV(n) DEVICE_DT_INST_GET(n),
+static const struct device *const asdc_channels[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_CHANNEL_DEV)
+};
+
+// channel the next priority scan starts at, so that channels of equal priority take turns
+static size_t asdc_tx_rr_next;
+
+// Events the transport had no buffer for, one per l2cap channel, sent first on the next run of
+// the tx work. The other l2cap channels carry on meanwhile.
+static struct asdc_tx_event asdc_tx_retry[ASDC_L2CAP_CHANNELS];
+static uint32_t asdc_tx_retry_pending;
+
+static void asdc_tx_ready_work_callback(struct k_work *work)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_channels); i++) {
+        const struct device *dev = asdc_channels[i];
+        struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+
+        if (asdc_data->tx_ready_cb && atomic_cas(&asdc_data->tx_blocked, 1, 0)) {
+            asdc_data->tx_ready_cb(dev);
+        }
+    }
+}
+
+K_WORK_DEFINE(asdc_tx_ready_work, asdc_tx_ready_work_callback);
+
+void asdc_tx_space_freed(const struct device *dev)
+{
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+
+    k_sem_give(&asdc_data->tx_space);
+    if (atomic_get(&asdc_data->tx_blocked)) {
+        k_work_submit_to_queue(&asdc_work_q, &asdc_tx_ready_work);
+    }
+}
+
+bool asdc_peer_is_connected(uint8_t peer)
+{
+    return peer < ASDC_MAX_PEERS && atomic_test_bit(&asdc_peers_connected, peer);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER)
+// peers that announced they read compact headers since they connected
+static atomic_t asdc_peers_compact;
+
+// the packet flags travel in the first byte of a compact header
+BUILD_ASSERT(((ASDC_PACKET_FLAG_FRAGMENT | ASDC_PACKET_FLAG_CONTROL | ASDC_PACKET_FLAG_CODEC_MASK) &
+              ~ASDC_WIRE_PACKET_FLAGS) == 0);
+#endif
+
+uint8_t asdc_tx_wire_version(uint8_t peer)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER)
+    atomic_val_t compact = atomic_get(&asdc_peers_compact);
+
+    if (peer == ASDC_PEER_BROADCAST) {
+        atomic_val_t connected = atomic_get(&asdc_peers_connected);
+        if (connected && !(connected & ~compact)) {
+            return ASDC_WIRE_VERSION_COMPACT;
+        }
+    } else if (peer < ASDC_MAX_PEERS && (compact & BIT(peer))) {
+        return ASDC_WIRE_VERSION_COMPACT;
+    }
+#endif
+    return ASDC_WIRE_VERSION_LEGACY;
+}
+
+uint32_t asdc_tx_queued(void)
+{
+    // the retry slots are only touched by the tx work, reading them unlocked is good enough here
+    uint32_t queued = k_msgq_num_used_get(&asdc_ctrl_msgq) + __builtin_popcount(asdc_tx_retry_pending);
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_channels); i++) {
+        queued += k_msgq_num_used_get(((const struct asdc_config *)asdc_channels[i]->config)->tx_msgq);
+    }
+    return queued;
+}
+
+uint32_t asdc_tx_bytes_sent(void)
+{
+    return (uint32_t)atomic_get(&asdc_tx_bytes);
+}
+
+// Takes the next event from the highest priority channel that has one queued, skipping those
+// sent over an l2cap channel whose bit is set in blocked.
+static bool asdc_tx_dequeue(struct asdc_tx_event *ev, uint32_t blocked)
+{
+    for (uint8_t i = 0; i < ASDC_L2CAP_CHANNELS; i++) {
+        if ((asdc_tx_retry_pending & BIT(i)) && !(blocked & BIT(i))) {
+            *ev = asdc_tx_retry[i];
+            asdc_tx_retry_pending &= ~BIT(i);
+            return true;
+        }
+    }
+
+    if (k_msgq_peek(&asdc_ctrl_msgq, ev) == 0 && !(blocked & BIT(asdc_l2cap_channel(ev->dev))) &&
+        k_msgq_get(&asdc_ctrl_msgq, ev, K_NO_WAIT) == 0) {
+        return true;
+    }
+
+    const struct asdc_config *best = NULL;
+    size_t best_idx = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_channels); i++) {
+        size_t idx = (asdc_tx_rr_next + i) % ARRAY_SIZE(asdc_channels);
+        const struct asdc_config *cfg = (const struct asdc_config *)asdc_channels[idx]->config;
+        if (blocked & BIT(cfg->l2cap_channel)) {
+            continue;
+        }
+        if ((!best || cfg->priority < best->priority) && k_msgq_num_used_get(cfg->tx_msgq) > 0) {
+            best = cfg;
+            best_idx = idx;
+        }
+    }
+
+    if (!best) {
+        return false;
+    }
+
+    asdc_tx_rr_next = (best_idx + 1) % ARRAY_SIZE(asdc_channels);
+    if (k_msgq_get(best->tx_msgq, ev, K_NO_WAIT) < 0) {
+        return false;
+    }
+
+    asdc_tx_space_freed(asdc_channels[best_idx]);
+    return true;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCHING)
+// sdu being filled with queued packets, of any channel, by the tx work
+static struct net_buf *asdc_tx_batch;
+static const struct device *asdc_tx_batch_dev;
+static uint8_t asdc_tx_batch_peer;
+// the events of the packets in the batch, they keep their pool blocks until it is sent
+static struct asdc_tx_event asdc_tx_batch_events[CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCH_MAX_PACKETS];
+static size_t asdc_tx_batch_count;
+// set while the transport had no buffer for the batch, it is sent first on the next run
+static bool asdc_tx_batch_parked;
+
+// Puts ev back in front of the channel traffic after its batch failed, as channel traffic. Only
+// done once and for channels with tx-credits, whose seq would be missing otherwise.
+static bool asdc_tx_batch_requeue(struct asdc_tx_event *ev, int err)
+{
+    if (ev->control || ev->requeued || err == -ENOTCONN ||
+        ((const struct asdc_config *)ev->dev->config)->tx_credits == 0) {
+        return false;
+    }
+
+    ev->requeued = true;
+    if (k_msgq_put(&asdc_ctrl_msgq, ev, K_NO_WAIT) < 0) {
+        return false;
+    }
+    ASDC_STAT_INC(ev->dev, tx_retransmits);
+    return true;
+}
+
+// Sends the current batch. On -ENOBUFS the batch is kept as it is, parked until the next run of
+// the tx work like a single event in asdc_tx_retry, and its l2cap channel is set in blocked. Any
+// other failure drops its packets, except for those asdc_tx_batch_requeue() takes.
+static int asdc_tx_batch_flush(uint32_t *blocked)
+{
+    if (!asdc_tx_batch || asdc_tx_batch_parked) {
+        return 0;
+    }
+
+    int err = asdc_transport_send_buf(asdc_tx_batch_dev, asdc_tx_batch_peer, asdc_tx_batch);
+    if (err == -ENOBUFS) {
+        asdc_tx_batch_parked = true;
+        *blocked |= BIT(asdc_l2cap_channel(asdc_tx_batch_dev));
+        return err;
+    }
+    asdc_tx_batch = NULL;
+
+    if (err < 0) {
+        LOG_WRN("Failed to send batch of %zu asdc packets: %d", asdc_tx_batch_count, err);
+        *blocked |= BIT(asdc_l2cap_channel(asdc_tx_batch_dev));
+    }
+
+    for (size_t i = 0; i < asdc_tx_batch_count; i++) {
+        struct asdc_tx_event *ev = &asdc_tx_batch_events[i];
+
+        if (err == 0 && !ev->control) {
+            asdc_stats_sent(ev);
+        } else if (err < 0 && asdc_tx_batch_requeue(ev, err)) {
+            continue;
+        } else if (err < 0 && !ev->control) {
+            ASDC_STAT_INC(ev->dev, tx_dropped);
+        }
+        asdc_tx_packet_done(ev);
+    }
+
+    asdc_tx_batch_count = 0;
+    return err;
+}
+
+// Appends the packet of ev to the current batch, which then owns ev. Returns false if it has to
+// be sent on its own. Batches sent to make room go to asdc_tx_batch_flush() with blocked.
+static bool asdc_tx_batch_add(const struct asdc_tx_event *ev, uint32_t *blocked)
+{
+    // a parked batch waits for the transport, the others go out unbatched meanwhile
+    if (asdc_tx_batch_parked || ev->buf || (*blocked & BIT(asdc_l2cap_channel(ev->dev)))) {
+        return false;
+    }
+
+    // an sdu goes over one l2cap channel
+    if (asdc_tx_batch && (asdc_tx_batch_peer != ev->peer ||
+                          asdc_l2cap_channel(asdc_tx_batch_dev) != asdc_l2cap_channel(ev->dev))) {
+        if (asdc_tx_batch_flush(blocked) < 0) {
+            return false;
+        }
+    }
+
+    // a compact header keeps the length, the receiver finds the next packet after it
+    const uint8_t version = asdc_tx_wire_version(ev->peer);
+    const struct asdc_wire_packet packet = asdc_wire_packet_of((const struct asdc_packet *)ev->data);
+    const size_t header_len = asdc_wire_header_size(&packet, version, true);
+
+    size_t mtu = asdc_transport_get_mtu(ev->dev, ev->peer);
+    if (header_len + packet.len > mtu) {
+        return false;
+    }
+
+    if (asdc_tx_batch && (asdc_tx_batch->len + header_len + packet.len > mtu ||
+                          asdc_tx_batch_count == ARRAY_SIZE(asdc_tx_batch_events))) {
+        if (asdc_tx_batch_flush(blocked) < 0) {
+            return false;
+        }
+    }
+
+    if (!asdc_tx_batch) {
+        asdc_tx_batch = asdc_transport_alloc_buf(ev->dev, mtu, K_NO_WAIT);
+        if (!asdc_tx_batch) {
+            return false;
+        }
+        asdc_tx_batch_dev = ev->dev;
+        asdc_tx_batch_peer = ev->peer;
+    }
+
+    asdc_tx_batch_events[asdc_tx_batch_count++] = *ev;
+    asdc_wire_put_header(net_buf_add(asdc_tx_batch, header_len), &packet, version, true);
+    net_buf_add_mem(asdc_tx_batch, packet.data, packet.len);
+    return true;
+}
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_CODEC_RLE)
+#define ASDC_TX_CODEC ASDC_CODEC_RLE
+#else
+#define ASDC_TX_CODEC ASDC_CODEC_LZF
+#endif
+
+// Replaces the packet of ev with a compressed one if that is smaller. Compressed data starts with
+// the uncompressed length as 16 bit little-endian.
+static void asdc_tx_compress(struct asdc_tx_event *ev)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)ev->dev->config;
+    struct asdc_packet *packet = (struct asdc_packet *)ev->data;
+
+    // retransmissions and retried events are compressed already
+    if (!cfg->compress || ev->control || ev->buf || (packet->flags & ASDC_PACKET_FLAG_CODEC_MASK) ||
+        packet->len < CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION_THRESHOLD ||
+        packet->len > UINT16_MAX) {
+        return;
+    }
+
+    struct asdc_packet *out = asdc_pool_alloc(ev->len);
+    if (!out) {
+        return;
+    }
+
+    // only worth it if the result, length included, is smaller
+    int len = asdc_compress(ASDC_TX_CODEC, packet->data, packet->len, out->data + sizeof(uint16_t),
+                            packet->len - sizeof(uint16_t) - 1);
+    if (len < 0) {
+        asdc_pool_free(out);
+        return;
+    }
+
+    *out = *packet;
+    out->flags |= ASDC_TX_CODEC << ASDC_PACKET_FLAG_CODEC_SHIFT;
+    out->len = sizeof(uint16_t) + len;
+    sys_put_le16(packet->len, out->data);
+
+    asdc_pool_free(packet);
+    ev->data = (uint8_t *)out;
+    ev->len = sizeof(struct asdc_packet) + out->len;
+}
+#endif
 
 void asdc_tx_work_callback(struct k_work *work) {
     struct asdc_tx_event ev;
-    while (k_msgq_get(&asdc_tx_msgq, &ev, K_NO_WAIT) == 0) {
-        asdc_transport_send_data(ev.dev, ev.data, ev.len);
-        free(ev.data);
+    // l2cap channels the transport ran out of buffers for during this run
+    uint32_t blocked = 0;
+
+    ASDC_TRACE("tx_work_enter", 0, 0);
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCHING)
+    // a batch the transport had no buffer for goes first, like the events in asdc_tx_retry
+    asdc_tx_batch_parked = false;
+    asdc_tx_batch_flush(&blocked);
+#endif
+
+    while (asdc_tx_dequeue(&ev, blocked)) {
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+        asdc_tx_compress(&ev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCHING)
+        if (asdc_tx_batch_add(&ev, &blocked)) {
+            continue;
+        }
+        // keep packets in order, whatever is batched goes out first
+        asdc_tx_batch_flush(&blocked);
+#endif
+        if (asdc_tx_send_event(&ev) == -ENOBUFS) {
+            // picked up again once the transport calls asdc_on_tx_ready()
+            uint8_t chan = asdc_l2cap_channel(ev.dev);
+            asdc_tx_retry[chan] = ev;
+            asdc_tx_retry_pending |= BIT(chan);
+            blocked |= BIT(chan);
+        }
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCHING)
+    asdc_tx_batch_flush(&blocked);
+#endif
+
+    ASDC_TRACE("tx_work_exit", 0, 0);
+}
+
+// events whose buffer a consumer kept with asdc_rx_hold()
+static struct asdc_rx_event asdc_rx_held[CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_MAX_HELD];
+static ATOMIC_DEFINE(asdc_rx_held_used, CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_MAX_HELD);
+// consumers holding each of them, plus the delivery while it runs
+static atomic_t asdc_rx_held_refs[CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_MAX_HELD];
+
+static void asdc_rx_event_release(struct asdc_rx_event *ev)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_ZERO_COPY)
+    if (ev->buf) {
+        asdc_transport_rx_release(ev->rx_ctx, ev->buf);
+        return;
+    }
+#endif
+    asdc_pool_free(ev->data);
+}
+
+static bool asdc_sub_matches(const struct asdc_subscriber *sub, const struct asdc_rx_event *ev)
+{
+    return sub->type == ASDC_SUB_TYPE_ANY || (ev->len > 0 && ev->data[0] == sub->type);
+}
+
+// Passes a received message to the recv callback and the matching subscribers of its channel,
+// all of them get the same buffer. It is released afterwards unless one of them held it.
+static void asdc_rx_deliver(struct asdc_rx_event *ev)
+{
+    const struct device *dev = ev->dev;
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+
+    k_mutex_lock(&asdc_data->sub_lock, K_FOREVER);
+
+    if (asdc_data->recv_cb == NULL && sys_slist_is_empty(&asdc_data->subscribers)) {
+        k_mutex_unlock(&asdc_data->sub_lock);
+        LOG_WRN("No recv callback assigned on device %s", dev->name);
+        ASDC_STAT_INC(dev, rx_dropped);
+        asdc_credit_consumed(dev, ev->peer, ev->seq);
+        asdc_rx_event_release(ev);
+        return;
+    }
+
+    ASDC_STAT_INC(dev, rx_messages);
+    ASDC_STAT_ADD(dev, rx_bytes, ev->len);
+    ASDC_TRACE("rx_dispatch", ((const struct asdc_config *)dev->config)->channel_id, ev->len);
+
+    asdc_data->rx_current = ev;
+    asdc_data->rx_current_held = NULL;
+    if (asdc_data->recv_cb) {
+        asdc_data->recv_cb(dev, ev->peer, ev->data, ev->len);
+    }
+
+    // the callbacks may unsubscribe any subscriber, asdc_unsubscribe() keeps sub_next valid
+    struct asdc_subscriber *sub = SYS_SLIST_PEEK_HEAD_CONTAINER(&asdc_data->subscribers, sub, node);
+    while (sub) {
+        asdc_data->sub_next = SYS_SLIST_PEEK_NEXT_CONTAINER(sub, node);
+        if (asdc_sub_matches(sub, ev)) {
+            sub->cb(dev, ev->peer, ev->data, ev->len, sub->user_data);
+        }
+        sub = asdc_data->sub_next;
+    }
+
+    asdc_data->rx_current = NULL;
+    if (asdc_data->rx_current_held) {
+        // the consumers that held it release it, drop the reference of the delivery
+        asdc_rx_release(asdc_data->rx_current_held);
+        asdc_data->rx_current_held = NULL;
+    } else {
+        asdc_rx_event_release(ev);
+    }
+
+    k_mutex_unlock(&asdc_data->sub_lock);
+    asdc_credit_consumed(dev, ev->peer, ev->seq);
+}
+
+// drains the rx queue of one channel, so its messages are passed on one at a time and in order
+void asdc_rx_work_callback(struct k_work *work) {
+    struct asdc_data *asdc_data = CONTAINER_OF(work, struct asdc_data, rx_work);
+    const struct asdc_config *cfg = (const struct asdc_config *)asdc_data->dev->config;
+    struct asdc_rx_event ev;
+
+    ASDC_TRACE("rx_work_enter", cfg->channel_id, 0);
+
+    while (k_msgq_get(cfg->rx_msgq, &ev, K_NO_WAIT) == 0) {
+        asdc_rx_deliver(&ev);
+    }
+
+    ASDC_TRACE("rx_work_exit", cfg->channel_id, 0);
+}
+
+// Passes a received message on according to the rx-dispatch policy of its channel. Fails only
+// if the rx queue is full, the caller still owns the message then.
+static int asdc_rx_dispatch(struct asdc_rx_event *ev)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)ev->dev->config;
+    struct asdc_data *asdc_data = (struct asdc_data *)ev->dev->data;
+
+    if (cfg->rx_dispatch == ASDC_RX_DISPATCH_INLINE) {
+        asdc_rx_deliver(ev);
+        return 0;
+    }
+
+    int ret = k_msgq_put(cfg->rx_msgq, ev, K_NO_WAIT);
+    if (ret < 0) {
+        return ret;
+    }
+
+    struct k_work_q *work_q = asdc_data->rx_work_q;
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD)
+    if (cfg->rx_dispatch == ASDC_RX_DISPATCH_THREAD) {
+        work_q = &asdc_rx_work_q;
+    }
+#endif
+    k_work_submit_to_queue(work_q ? work_q : &k_sys_work_q, &asdc_data->rx_work);
+    return 0;
+}
+
+int asdc_set_rx_work_q(const struct device *dev, struct k_work_q *work_q)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    if (cfg->rx_dispatch != ASDC_RX_DISPATCH_WORKQUEUE) {
+        return -ENOTSUP;
+    }
+
+    ((struct asdc_data *)dev->data)->rx_work_q = work_q;
+    return 0;
+}
+
+int asdc_subscribe(const struct device *dev, struct asdc_subscriber *sub)
+{
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+    int ret = 0;
+
+    if (!sub->cb) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&asdc_data->sub_lock, K_FOREVER);
+    struct asdc_subscriber *cur;
+    SYS_SLIST_FOR_EACH_CONTAINER(&asdc_data->subscribers, cur, node) {
+        if (cur == sub) {
+            ret = -EALREADY;
+            break;
+        }
+    }
+    if (ret == 0) {
+        sys_slist_append(&asdc_data->subscribers, &sub->node);
+    }
+    k_mutex_unlock(&asdc_data->sub_lock);
+    return ret;
+}
+
+int asdc_unsubscribe(const struct device *dev, struct asdc_subscriber *sub)
+{
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+
+    // the lock is recursive, so subscribers can be removed from a callback
+    k_mutex_lock(&asdc_data->sub_lock, K_FOREVER);
+    if (asdc_data->sub_next == sub) {
+        // the delivery in progress was going to call it next
+        asdc_data->sub_next = SYS_SLIST_PEEK_NEXT_CONTAINER(sub, node);
+    }
+    bool found = sys_slist_find_and_remove(&asdc_data->subscribers, &sub->node);
+    k_mutex_unlock(&asdc_data->sub_lock);
+    return found ? 0 : -ENOENT;
+}
+
+void *asdc_rx_hold(const struct device *dev)
+{
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+    struct asdc_rx_event *ev = asdc_data->rx_current;
+    if (!ev) {
+        LOG_ERR("asdc_rx_hold called outside of the recv callback of device %s", dev->name);
+        return NULL;
+    }
+
+    // another consumer of the message held it already, share its slot
+    struct asdc_rx_event *held = (struct asdc_rx_event *)asdc_data->rx_current_held;
+    if (held) {
+        atomic_inc(&asdc_rx_held_refs[held - asdc_rx_held]);
+        return held;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_rx_held); i++) {
+        if (!atomic_test_and_set_bit(asdc_rx_held_used, i)) {
+            asdc_rx_held[i] = *ev;
+            // one reference for the consumer, one for the delivery still running
+            atomic_set(&asdc_rx_held_refs[i], 2);
+            asdc_data->rx_current_held = &asdc_rx_held[i];
+            return &asdc_rx_held[i];
+        }
+    }
+
+    LOG_WRN("No free slot to hold asdc rx buffer on device %s", dev->name);
+    return NULL;
+}
+
+void asdc_rx_release(void *handle)
+{
+    struct asdc_rx_event *ev = (struct asdc_rx_event *)handle;
+    if (!ev) {
+        return;
+    }
+
+    size_t i = ev - asdc_rx_held;
+    if (i >= ARRAY_SIZE(asdc_rx_held) || !atomic_test_bit(asdc_rx_held_used, i)) {
+        LOG_ERR("Invalid asdc rx hold handle");
+        return;
+    }
+
+    if (atomic_dec(&asdc_rx_held_refs[i]) > 1) {
+        return;
+    }
+
+    asdc_rx_event_release(ev);
+    atomic_clear_bit(asdc_rx_held_used, i);
+}
+
+static int asdc_init(const struct device *dev)
+{
+    return asdc_transport_init(dev);
+}
+
+K_WORK_DELAYABLE_DEFINE(asdc_tx_work, asdc_tx_work_callback);
+
+// Channels by id. While the ids in use are dense the table is indexed by the id itself and holds
+// one entry per id up to the highest one, which is the size of a union with an array of id + 1
+// bytes per channel. Sparse ids would make that table large, those channels are kept sorted by
+// id and found by binary search instead.
+#define ASDC_CHANNEL_ID_SPAN_MEMBER(n) uint8_t channel_##n[DT_INST_PROP(n, channel_id) + 1];
+union asdc_channel_id_span {
+    uint8_t none;
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_CHANNEL_ID_SPAN_MEMBER)
+};
+
+// two channels with the same id declare the same enumerator, which fails the build
+#define ASDC_CHANNEL_ID_UNIQUE(n)                                               \
+    enum { UTIL_CAT(asdc_duplicate_channel_id_, DT_INST_PROP(n, channel_id)) };
+DT_INST_FOREACH_STATUS_OKAY(ASDC_CHANNEL_ID_UNIQUE)
+
+#define ASDC_CHANNEL_COUNT DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT)
+#define ASDC_CHANNEL_TABLE_MAX (4 * ASDC_CHANNEL_COUNT + 32)
+#define ASDC_CHANNEL_TABLE_DIRECT (sizeof(union asdc_channel_id_span) <= ASDC_CHANNEL_TABLE_MAX)
+
+struct asdc_channel_id_entry {
+    uint16_t id;
+    const struct device *dev;
+};
+
+static const struct device *
+    asdc_channel_table[ASDC_CHANNEL_TABLE_DIRECT ? sizeof(union asdc_channel_id_span) : 1];
+static struct asdc_channel_id_entry
+    asdc_channel_ids[ASDC_CHANNEL_TABLE_DIRECT ? 1 : ASDC_CHANNEL_COUNT];
+
+BUILD_ASSERT(ARRAY_SIZE(asdc_channel_table) <= ASDC_CHANNEL_TABLE_MAX,
+             "direct channel table larger than its limit");
+
+static int asdc_channel_table_init(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_channels); i++) {
+        const struct device *dev = asdc_channels[i];
+        uint16_t id = ((const struct asdc_config *)dev->config)->channel_id;
+
+        if (ASDC_CHANNEL_TABLE_DIRECT) {
+            asdc_channel_table[id] = dev;
+            continue;
+        }
+
+        // insertion sort, the list only has as many entries as there are channels
+        size_t pos = i;
+        for (; pos > 0 && asdc_channel_ids[pos - 1].id > id; pos--) {
+            asdc_channel_ids[pos] = asdc_channel_ids[pos - 1];
+        }
+        asdc_channel_ids[pos] = (struct asdc_channel_id_entry){.id = id, .dev = dev};
+    }
+    return 0;
+}
+
+SYS_INIT(asdc_channel_table_init, PRE_KERNEL_1, 0);
+
+static const struct device *find_dev_for_channel_id(uint16_t channel_id) {
+    if (ASDC_CHANNEL_TABLE_DIRECT) {
+        if (channel_id >= ARRAY_SIZE(asdc_channel_table)) {
+            return NULL;
+        }
+        return asdc_channel_table[channel_id];
+    }
+
+    size_t lo = 0;
+    size_t hi = ASDC_CHANNEL_COUNT;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (asdc_channel_ids[mid].id == channel_id) {
+            return asdc_channel_ids[mid].dev;
+        }
+        if (asdc_channel_ids[mid].id < channel_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static void asdc_tx_event_release(struct asdc_tx_event *ev)
+{
+    if (ev->buf) {
+        net_buf_unref(ev->buf);
+    } else {
+        asdc_pool_free(ev->data);
+    }
+}
+
+static struct asdc_packet *asdc_tx_event_packet(const struct asdc_tx_event *ev)
+{
+    return (struct asdc_packet *)(ev->buf ? ev->buf->data : ev->data);
+}
+
+// queue depth of a coalescing channel, a message for each peer and a broadcast
+#define ASDC_COALESCING_SLOTS (ASDC_MAX_PEERS + 1)
+
+// serializes the producers of coalescing channels while they look for a message to replace
+static struct k_spinlock asdc_coalesce_lock;
+
+// Queues ev on a coalescing channel, whose queue holds one message for each peer. A message still
+// queued for the same peer is replaced and ev takes over its sequence number, and so its credit,
+// as it was never sent. Returns the replaced event in stale, to be released by the caller.
+static int asdc_coalesce_tx(const struct device *dev, struct asdc_tx_event *ev,
+                            struct asdc_tx_event *stale, bool *replaced)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_tx_event queued[ASDC_COALESCING_SLOTS];
+    size_t count = 0;
+    int ret = 0;
+
+    *replaced = false;
+
+    // the tx work may take messages out meanwhile, those are being sent and stay as they are
+    k_spinlock_key_t key = k_spin_lock(&asdc_coalesce_lock);
+    while (count < ARRAY_SIZE(queued) && k_msgq_get(cfg->tx_msgq, &queued[count], K_NO_WAIT) == 0) {
+        count++;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!*replaced && queued[i].peer == ev->peer) {
+            asdc_tx_event_packet(ev)->seq = asdc_tx_event_packet(&queued[i])->seq;
+            *stale = queued[i];
+            queued[i] = *ev;
+            *replaced = true;
+        }
+    }
+
+    if (!*replaced) {
+        if (cfg->tx_credits > 0 && !asdc_credit_take(dev, ev->peer, asdc_tx_event_packet(ev))) {
+            ret = -EAGAIN;
+        } else {
+            queued[count++] = *ev;
+        }
+    }
+
+    // a slot per peer, so this always fits again
+    for (size_t i = 0; i < count; i++) {
+        k_msgq_put(cfg->tx_msgq, &queued[i], K_NO_WAIT);
+    }
+    k_spin_unlock(&asdc_coalesce_lock, key);
+
+    return ret;
+}
+
+// one attempt at queueing ev, -EAGAIN if the channel's queue or the peer's credit window is full
+static int asdc_try_queue_tx(const struct device *dev, struct asdc_tx_event *ev)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+
+    if (cfg->tx_credits > 0) {
+        // broadcasts only get here on single-peer builds, where they go to peer 0
+        if (!asdc_peer_is_connected(ev->peer == ASDC_PEER_BROADCAST ? 0 : ev->peer)) {
+            return -ENOTCONN;
+        }
+    }
+
+    if (cfg->mode == ASDC_MODE_COALESCING) {
+        struct asdc_tx_event stale;
+        bool replaced;
+        int ret = asdc_coalesce_tx(dev, ev, &stale, &replaced);
+        if (replaced) {
+            asdc_tx_event_release(&stale);
+        }
+        return ret;
+    }
+
+    if (k_msgq_num_free_get(cfg->tx_msgq) == 0) {
+        return -EAGAIN;
+    }
+
+    if (cfg->tx_credits > 0 && !asdc_credit_take(dev, ev->peer, asdc_tx_event_packet(ev))) {
+        return -EAGAIN;
+    }
+
+    if (k_msgq_put(cfg->tx_msgq, ev, K_NO_WAIT) < 0) {
+        // another producer filled the queue in the meantime
+        asdc_credit_untake(dev, ev->peer);
+        return -EAGAIN;
+    }
+    return 0;
+}
+
+static int asdc_queue_tx(const struct device *dev, struct asdc_tx_event *ev, k_timepoint_t end)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+    ev->queued_at = k_cycle_get_32();
+#endif
+
+    int ret = asdc_try_queue_tx(dev, ev);
+    while (ret == -EAGAIN) {
+        // flag first and try once more, so that room freed up in between is not missed
+        atomic_set(&asdc_data->tx_blocked, 1);
+        ret = asdc_try_queue_tx(dev, ev);
+        if (ret != -EAGAIN || sys_timepoint_expired(end)) {
+            break;
+        }
+        k_sem_take(&asdc_data->tx_space, sys_timepoint_timeout(end));
+        ret = asdc_try_queue_tx(dev, ev);
+    }
+
+    if (ret == 0) {
+        asdc_stats_queued(dev, cfg->tx_msgq);
+    }
+    return ret;
+}
+
+static void asdc_schedule_tx(uint32_t delay_ms)
+{
+    asdc_link_wake();
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCHING)
+    // give other messages a chance to join the same sdu
+    delay_ms = MAX(delay_ms, CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_BATCH_LINGER_MS);
+#endif
+    if (delay_ms > 0) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_tx_work, K_MSEC(delay_ms));
+    } else {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_tx_work, K_NO_WAIT);
     }
 }
 
-void asdc_rx_work_callback(struct k_work *work) {
-    struct asdc_rx_event ev;
-    while (k_msgq_get(&asdc_rx_msgq, &ev, K_NO_WAIT) == 0) {
-        const struct device *dev = ev.dev;
-        if (!dev) {
-            LOG_ERR("No device for receiving data");
-            continue;
-        }
+void asdc_on_tx_ready(void)
+{
+    // does not cut short a pending delay or batching linger
+    k_work_schedule_for_queue(&asdc_work_q, &asdc_tx_work, K_NO_WAIT);
+}
+
+static int asdc_work_q_init(void)
+{
+    static const struct k_work_queue_config cfg = {
+        .name = "asdc_work_q",
+    };
+
+    k_work_queue_start(&asdc_work_q, asdc_work_q_stack, K_THREAD_STACK_SIZEOF(asdc_work_q_stack),
+                       CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WORKQUEUE_PRIORITY, &cfg);
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD)
+    static const struct k_work_queue_config rx_cfg = {
+        .name = "asdc_rx_work_q",
+    };
+
+    k_work_queue_start(&asdc_rx_work_q, asdc_rx_work_q_stack,
+                       K_THREAD_STACK_SIZEOF(asdc_rx_work_q_stack),
+                       CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD_PRIORITY, &rx_cfg);
+#endif
+    return 0;
+}
+
+SYS_INIT(asdc_work_q_init, POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
 
-        struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
-        if (asdc_data->recv_cb == NULL) {
-            LOG_WRN("No recv callback assigned on device %s", dev->name);
-            continue;
-        }
-        asdc_data->recv_cb(dev, ev.conn, ev.data, ev.len);
-        free(ev.data);
+// queues a copy of a packet on the control queue, which is sent ahead of every channel
+static int asdc_queue_priority(const struct device *dev, uint8_t peer, uint8_t flags, uint8_t seq,
+                               const void *data, size_t len)
+{
+    struct asdc_packet *packet = asdc_pool_alloc(sizeof(struct asdc_packet) + len);
+    if (!packet) {
+        return -ENOMEM;
+    }
+
+    memcpy(packet->data, data, len);
+    packet->len = len;
+    packet->channel_id = ((const struct asdc_config *)dev->config)->channel_id;
+    packet->flags = flags;
+    packet->seq = seq;
+
+    struct asdc_tx_event ev = {
+        .dev = dev,
+        .peer = peer,
+        .len = sizeof(struct asdc_packet) + len,
+        .data = (uint8_t *)packet,
+        .control = true,
+    };
+    int ret = k_msgq_put(&asdc_ctrl_msgq, &ev, K_NO_WAIT);
+    if (ret < 0) {
+        asdc_pool_free(packet);
+        return ret;
     }
+
+    asdc_schedule_tx(0);
+    return 0;
 }
 
-static int asdc_init(const struct device *dev)
+int asdc_queue_control(const struct device *dev, uint8_t peer, const void *msg, size_t len)
 {
-    return asdc_transport_init(dev);
+    return asdc_queue_priority(dev, peer, ASDC_PACKET_FLAG_CONTROL, 0, msg, len);
 }
 
-K_WORK_DELAYABLE_DEFINE(asdc_tx_work, asdc_tx_work_callback);
-K_WORK_DEFINE(asdc_rx_work, asdc_rx_work_callback);
-
-const struct device* find_dev_for_channel_id(int channel_id) {
-    const struct device *dev = NULL;
-    #define ASDC_FIND_DEV(n)                                                                \
-        do {                                                                                \
-            const struct device *d = DEVICE_DT_INST_GET(n);                                 \
-            if (d && device_is_ready(d)) {                                                  \
-                const struct asdc_config *cfg = (const struct asdc_config *)d->config;      \
-                if (cfg->channel_id == channel_id) {                                        \
-                    dev = d;                                                                \
-                    break;                                                                  \
-                }                                                                           \
-            }                                                                               \
-        } while (0);
-    DT_INST_FOREACH_STATUS_OKAY(ASDC_FIND_DEV)
-    return dev;
+int asdc_queue_retransmit(const struct device *dev, uint8_t peer, const struct asdc_packet *packet)
+{
+    int ret = asdc_queue_priority(dev, peer, packet->flags, packet->seq, packet->data, packet->len);
+    if (ret == 0) {
+        ASDC_STAT_INC(dev, tx_retransmits);
+    }
+    return ret;
 }
 
-static int asdc_send_data(const struct device *dev, const uint8_t *data, size_t len, uint32_t delay_ms)
+// takes a block for a tx packet from the channel's own blocks, if it has any
+static void *asdc_tx_alloc(const struct device *dev, size_t size)
+{
+    struct asdc_pool_class *pool = ((const struct asdc_config *)dev->config)->pool;
+    return pool ? asdc_pool_class_alloc(pool, size) : asdc_pool_alloc(size);
+}
+
+// copies data into a pool block and queues it for peer
+static int asdc_send_packet(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, k_timepoint_t end)
 {
-    struct asdc_packet *packet = malloc(sizeof(struct asdc_packet) + len);
+    struct asdc_packet *packet = asdc_tx_alloc(dev, sizeof(struct asdc_packet) + len);
     if (!packet) {
-        LOG_ERR("Failed to allocate memory for asdc_packet");
+        LOG_ERR("Failed to allocate pool block for asdc_packet");
+        ASDC_STAT_INC(dev, tx_alloc_failures);
         return -ENOMEM;
     }
 
     memcpy(packet->data, data, len);
     packet->len = len;
     packet->channel_id = ((const struct asdc_config *)dev->config)->channel_id;
+    packet->flags = 0;
+    packet->seq = 0;
 
     struct asdc_tx_event ev = {
         .dev = dev,
+        .peer = peer,
         .len = sizeof(struct asdc_packet) + len,
         .data = (uint8_t *)packet,
     };
-    int ret =k_msgq_put(&asdc_tx_msgq, &ev, K_NO_WAIT);
+    int ret = asdc_queue_tx(dev, &ev, end);
     if (ret < 0) {
-        free(packet);
-        LOG_ERR("Failed to queue asdc data for sending on device %s: %d", dev->name, ret);
-        return ret;
+        asdc_pool_free(packet);
     }
-    
-    if (delay_ms > 0) {
-        k_work_schedule(&asdc_tx_work, K_MSEC(delay_ms));
+    return ret;
+}
+
+// queues data for peer, or for each connected peer if they need copies of their own
+static int asdc_send_peers(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len,
+                           k_timepoint_t end)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    int ret;
+
+    if (cfg->tx_credits > 0 && peer == ASDC_PEER_BROADCAST && ASDC_MAX_PEERS > 1) {
+        // every peer has its own credit window and sequence numbers, so each gets its own copy.
+        // It succeeds if any peer took the message.
+        ret = -ENOTCONN;
+        for (uint8_t p = 0; p < ASDC_MAX_PEERS; p++) {
+            if (!asdc_peer_is_connected(p)) {
+                continue;
+            }
+            int err = asdc_send_packet(dev, p, data, len, end);
+            if (err < 0) {
+                asdc_delta_unsent(dev, p);
+            }
+            if (ret < 0) {
+                ret = err;
+            }
+        }
+    } else {
+        ret = asdc_send_packet(dev, peer, data, len, end);
+        if (ret < 0) {
+            asdc_delta_unsent(dev, peer);
+        }
+    }
+    return ret;
+}
+
+// sends the difference of data to the snapshot the channel sent before
+static int asdc_send_delta(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len,
+                           k_timepoint_t end)
+{
+    uint8_t *msg;
+    int msg_len = asdc_delta_encode(dev, data, len, &msg);
+    if (msg_len < 0) {
+        if (msg_len == -EMSGSIZE) {
+            ASDC_STAT_INC(dev, tx_mtu_rejects);
+        } else if (msg_len == -ENOMEM) {
+            ASDC_STAT_INC(dev, tx_alloc_failures);
+        }
+        return msg_len;
+    }
+
+    int ret = asdc_send_peers(dev, peer, msg, msg_len, end);
+    asdc_pool_free(msg);
+    return ret;
+}
+
+static int asdc_send_common(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len,
+                            uint32_t delay_ms, k_timeout_t timeout)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+
+    if (peer != ASDC_PEER_BROADCAST && peer >= ASDC_MAX_PEERS) {
+        return -EINVAL;
+    }
+
+    // the messages of delta channels are as large as the data at most, plus their header
+    size_t max_len = len + (cfg->mode == ASDC_MODE_DELTA ? sizeof(struct asdc_delta_header) : 0);
+    // packets take a block of the channel's own pool if it has one, delta channels build their
+    // messages in a block of the shared pool first
+    size_t max_alloc = cfg->pool ? cfg->pool->block_size : asdc_pool_max_alloc_size();
+    if (sizeof(struct asdc_packet) + max_len > max_alloc ||
+        (cfg->mode == ASDC_MODE_DELTA && max_len > asdc_pool_max_alloc_size())) {
+        LOG_ERR("asdc data of %zu bytes exceeds the largest pool block", len);
+        ASDC_STAT_INC(dev, tx_mtu_rejects);
+        return -EMSGSIZE;
+    }
+    if (cfg->max_payload_size > 0 && max_len > cfg->max_payload_size) {
+        LOG_ERR("asdc data of %zu bytes exceeds the max-payload-size of device %s", len, dev->name);
+        ASDC_STAT_INC(dev, tx_mtu_rejects);
+        return -EMSGSIZE;
+    }
+
+    // kept whether or not it can be sent now, that is what a reconnecting peer needs
+    asdc_retain(dev, peer, data, len);
+
+    k_timepoint_t end = sys_timepoint_calc(timeout);
+    int ret;
+
+    if (cfg->mode == ASDC_MODE_DELTA) {
+        ret = asdc_send_delta(dev, peer, data, len, end);
     } else {
-        k_work_schedule(&asdc_tx_work, K_NO_WAIT);
+        ret = asdc_send_peers(dev, peer, data, len, end);
+    }
+
+    if (ret < 0) {
+        return ret;
     }
 
+    asdc_schedule_tx(delay_ms);
+
     return len;
 }
 
-void asdc_on_data_received(void* conn, uint8_t *data, size_t len)
+int asdc_queue_message(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len)
 {
-    LOG_DBG("asdc received %zu bytes", len);
-    
-    if (len < sizeof(struct asdc_packet)) {
-        LOG_ERR("Received data too small to contain asdc_packet header (need %zu, got %zu)", 
-                sizeof(struct asdc_packet), len);
-        return;
+    int ret = asdc_send_packet(dev, peer, data, len, sys_timepoint_calc(K_NO_WAIT));
+    if (ret == 0) {
+        asdc_schedule_tx(0);
+    }
+    return ret;
+}
+
+static int asdc_send_data_to(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, uint32_t delay_ms)
+{
+    // never waits, a full queue or credit window drops the message
+    int ret = asdc_send_common(dev, peer, data, len, delay_ms, K_NO_WAIT);
+    if (ret == -EAGAIN) {
+        ASDC_STAT_INC(dev, tx_dropped);
+        LOG_DBG("Failed to queue asdc data for sending on device %s", dev->name);
+        return -ENOMSG;
+    }
+    return ret;
+}
+
+static int asdc_send_data(const struct device *dev, const uint8_t *data, size_t len, uint32_t delay_ms)
+{
+    return asdc_send_data_to(dev, ASDC_PEER_BROADCAST, data, len, delay_ms);
+}
+
+static int asdc_send_data_timeout(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len, k_timeout_t timeout)
+{
+    return asdc_send_common(dev, peer, data, len, 0, timeout);
+}
+
+static int asdc_reserve_tx_data(const struct device *dev, size_t len, struct asdc_tx_span *span)
+{
+    if (len == 0) {
+        return -EINVAL;
+    }
+
+    // retransmissions need a copy of the packet that outlives the transport buffer, and delta
+    // channels send the difference to the previous message instead of the message itself
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    if (cfg->reliable || cfg->mode == ASDC_MODE_DELTA) {
+        return -ENOTSUP;
+    }
+
+    struct net_buf *buf = asdc_transport_alloc_buf(dev, sizeof(struct asdc_packet) + len, K_NO_WAIT);
+    if (!buf) {
+        ASDC_STAT_INC(dev, tx_alloc_failures);
+        return -ENOBUFS;
+    }
+
+    struct asdc_packet *packet = net_buf_add(buf, sizeof(struct asdc_packet));
+    packet->channel_id = cfg->channel_id;
+    packet->flags = 0;
+    packet->seq = 0;
+
+    span->data = net_buf_tail(buf);
+    span->len = len;
+    span->peer = ASDC_PEER_BROADCAST;
+    span->handle = buf;
+    return 0;
+}
+
+static int asdc_commit_tx_data(const struct device *dev, struct asdc_tx_span *span, uint32_t delay_ms)
+{
+    struct net_buf *buf = span->handle;
+    if (!buf) {
+        return -EINVAL;
+    }
+    span->handle = NULL;
+
+    // the reserved area is the tailroom right after the header, so this cannot overflow
+    if (span->len == 0 || span->data + span->len > net_buf_tail(buf) + net_buf_tailroom(buf) ||
+        (span->peer != ASDC_PEER_BROADCAST && span->peer >= ASDC_MAX_PEERS)) {
+        net_buf_unref(buf);
+        return -EINVAL;
+    }
+
+    // a single buffer cannot carry the different sequence numbers of every peer
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    if (cfg->tx_credits > 0 && span->peer == ASDC_PEER_BROADCAST && ASDC_MAX_PEERS > 1) {
+        net_buf_unref(buf);
+        return -ENOTSUP;
+    }
+
+    // the tx work may send buf, and let go of it, as soon as it is queued
+    const size_t len = span->len;
+    struct asdc_packet *packet = (struct asdc_packet *)buf->data;
+    packet->len = len;
+    net_buf_add(buf, len);
+
+    asdc_retain(dev, span->peer, packet->data, len);
+
+    struct asdc_tx_event ev = {
+        .dev = dev,
+        .peer = span->peer,
+        .len = buf->len,
+        .buf = buf,
+    };
+    int ret = asdc_queue_tx(dev, &ev, sys_timepoint_calc(K_NO_WAIT));
+    if (ret < 0) {
+        net_buf_unref(buf);
+        if (ret == -EAGAIN) {
+            ASDC_STAT_INC(dev, tx_dropped);
+            return -ENOMSG;
+        }
+        return ret;
+    }
+
+    asdc_schedule_tx(delay_ms);
+
+    return len;
+}
+
+static void asdc_abort_tx_data(const struct device *dev, struct asdc_tx_span *span)
+{
+    if (span->handle) {
+        net_buf_unref((struct net_buf *)span->handle);
+        span->handle = NULL;
+    }
+}
+
+// Decodes the header of the packet at the start of a received sdu, which may hold several batched
+// packets. Returns its size, or a negative error if the remaining data is malformed.
+static int asdc_parse_packet(uint8_t *data, size_t len, struct asdc_wire_packet *packet)
+{
+    int header_len = asdc_wire_parse(data, len,
+                                     IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER),
+                                     packet);
+    if (header_len < 0) {
+        LOG_ERR("Received malformed asdc packet (%d) in the last %zu bytes of an sdu", header_len, len);
+        return header_len;
     }
 
-    struct asdc_packet *packet = (struct asdc_packet *)data;
-    
     LOG_DBG("asdc packet contains %u bytes of data on channel_id=%u", packet->len, packet->channel_id);
+    return header_len;
+}
+
+int asdc_rx_queue(const struct device *dev, uint8_t peer, uint8_t seq, uint8_t *data, size_t len)
+{
+    uint8_t *payload = data;
+    int ret;
+
+    // delta channels pass on the snapshot that results from the message
+    if (((const struct asdc_config *)dev->config)->mode == ASDC_MODE_DELTA) {
+        ret = asdc_delta_decode(dev, peer, data, len, &payload, &len);
+        if (ret == -ESTALE) {
+            // consumed, a full snapshot follows. Reliable channels must not send it again.
+            ASDC_STAT_INC(dev, rx_dropped);
+            asdc_credit_consumed(dev, peer, seq);
+            asdc_pool_free(data);
+            return 0;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
 
-    if (packet->len + sizeof(packet->channel_id) + sizeof(packet->len) != len) {
-        LOG_ERR("Received asdc data length mismatch, got %zu, expected %u",
-                len, packet->len + sizeof(packet->channel_id) + sizeof(packet->len));
+    struct asdc_rx_event ev = {
+        .dev = dev,
+        .len = len,
+        .data = payload,
+        .peer = peer,
+        .seq = seq,
+    };
+    ret = asdc_rx_dispatch(&ev);
+    if (ret < 0) {
+        if (payload != data) {
+            // the snapshot moved on without the recv callback seeing it
+            asdc_pool_free(payload);
+            asdc_delta_resync(dev, peer);
+        }
+        return ret;
+    }
+    if (payload != data) {
+        asdc_pool_free(data);
+    }
+    return 0;
+}
+
+// queues a pool block holding a received payload, takes ownership of data
+static void asdc_queue_rx_block(const struct device *dev, uint8_t peer, uint8_t seq, uint8_t *data, size_t len)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    if (((const struct asdc_config *)dev->config)->reliable) {
+        asdc_reliable_received(dev, peer, seq, data, len);
+        return;
+    }
+#endif
+
+    int ret = asdc_rx_queue(dev, peer, seq, data, len);
+    if (ret < 0) {
+        asdc_pool_free(data);
+        ASDC_STAT_INC(dev, rx_dropped);
+        asdc_credit_consumed(dev, peer, seq);
+        LOG_DBG("Failed to queue received asdc data on device %s: %d", dev->name, ret);
+    }
+}
+
+// Returns a pool block holding the payload of a packet with the given flags, decompressed if it
+// was compressed, and its length in out_len. NULL if there is no free block or it is corrupt.
+static uint8_t *asdc_rx_payload(const struct device *dev, uint8_t flags, const uint8_t *data,
+                                size_t len, size_t *out_len)
+{
+    enum asdc_codec codec = (flags & ASDC_PACKET_FLAG_CODEC_MASK) >> ASDC_PACKET_FLAG_CODEC_SHIFT;
+    size_t payload_len = len;
+
+    if (codec != ASDC_CODEC_NONE) {
+        if (len < sizeof(uint16_t)) {
+            LOG_ERR("Received compressed asdc data without length on device %s", dev->name);
+            return NULL;
+        }
+        payload_len = sys_get_le16(data);
+        data += sizeof(uint16_t);
+        len -= sizeof(uint16_t);
+    }
+
+    uint8_t *payload = asdc_pool_alloc(payload_len);
+    if (!payload) {
+        LOG_ERR("Failed to allocate pool block for received asdc data");
+        ASDC_STAT_INC(dev, rx_alloc_failures);
+        return NULL;
+    }
+
+    if (codec == ASDC_CODEC_NONE) {
+        memcpy(payload, data, len);
+    } else if (asdc_decompress(codec, data, len, payload, payload_len) != (int)payload_len) {
+        LOG_ERR("Failed to decompress asdc data on device %s", dev->name);
+        asdc_pool_free(payload);
+        return NULL;
+    }
+
+    *out_len = payload_len;
+    return payload;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION)
+static void asdc_on_fragment_received(const struct device *dev, uint8_t peer, const struct asdc_wire_packet *packet)
+{
+    size_t len;
+    uint8_t *message = asdc_frag_reassemble(peer, packet, &len);
+    if (!message) {
+        return;
+    }
+
+    // fragments carry the flags of the whole message
+    if (packet->flags & ASDC_PACKET_FLAG_CODEC_MASK) {
+        uint8_t *compressed = message;
+        message = asdc_rx_payload(dev, packet->flags, compressed, len, &len);
+        asdc_pool_free(compressed);
+        if (!message) {
+            asdc_credit_consumed(dev, peer, packet->seq);
+            return;
+        }
+    }
+
+    asdc_queue_rx_block(dev, peer, packet->seq, message, len);
+}
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER)
+// tells peer which header formats it may send, it may also send the ones of older versions
+static void asdc_send_hello(uint8_t peer)
+{
+    if (ARRAY_SIZE(asdc_channels) == 0) {
+        return;
+    }
+
+    const struct asdc_ctrl_hello msg = {
+        .type = ASDC_CTRL_HELLO,
+        .wire_version = ASDC_WIRE_VERSION_COMPACT,
+    };
+    // without it the peer keeps sending legacy headers, which is fine
+    int err = asdc_queue_control(asdc_channels[0], peer, &msg, sizeof(msg));
+    if (err < 0) {
+        LOG_WRN("Failed to queue asdc hello for peer %u: %d", peer, err);
+    }
+}
+#endif
+
+static void asdc_hello_received(uint8_t peer, const struct asdc_ctrl_hello *msg)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER)
+    LOG_DBG("asdc peer %u reads wire version %u", peer, msg->wire_version);
+    if (msg->wire_version >= ASDC_WIRE_VERSION_COMPACT) {
+        atomic_set_bit(&asdc_peers_compact, peer);
         return;
     }
+    atomic_clear_bit(&asdc_peers_compact, peer);
+#endif
+}
 
-    if (packet->len == 0) {
-        LOG_ERR("Received asdc data with zero length");
+static void asdc_on_control_received(const struct device *dev, uint8_t peer, const struct asdc_wire_packet *packet)
+{
+    switch (packet->data[0]) {
+    case ASDC_CTRL_CREDIT: {
+        if (packet->len < sizeof(struct asdc_ctrl_credit)) {
+            break;
+        }
+        const struct asdc_ctrl_credit *msg = (const struct asdc_ctrl_credit *)packet->data;
+        asdc_credit_received(dev, peer, msg->seq);
+        return;
+    }
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    case ASDC_CTRL_ACK:
+        if (packet->len < sizeof(struct asdc_ctrl_ack)) {
+            break;
+        }
+        asdc_reliable_ack_received(dev, peer, (const struct asdc_ctrl_ack *)packet->data);
+        return;
+    case ASDC_CTRL_SYNC:
+        if (packet->len < sizeof(struct asdc_ctrl_sync)) {
+            break;
+        }
+        asdc_reliable_sync_received(dev, peer, (const struct asdc_ctrl_sync *)packet->data);
         return;
+#endif
+    case ASDC_CTRL_RESYNC:
+        asdc_delta_resync_received(dev, peer);
+        return;
+    case ASDC_CTRL_HELLO:
+        if (packet->len < sizeof(struct asdc_ctrl_hello)) {
+            break;
+        }
+        asdc_hello_received(peer, (const struct asdc_ctrl_hello *)packet->data);
+        return;
+    default:
+        break;
     }
 
+    LOG_WRN("Unknown asdc control message %u of %u bytes on device %s", packet->data[0],
+            packet->len, dev->name);
+}
+
+static void asdc_on_packet_received(uint8_t peer, const struct asdc_wire_packet *packet)
+{
     // find the device for the channel_id
     const struct device *dev = find_dev_for_channel_id(packet->channel_id);
     if (!dev) {
@@ -155,26 +1518,153 @@ void asdc_on_data_received(void* conn, uint8_t *data, size_t len)
         return;
     }
 
-    uint8_t *data_copy = malloc(packet->len);
+    if (packet->flags & ASDC_PACKET_FLAG_CONTROL) {
+        asdc_on_control_received(dev, peer, packet);
+        return;
+    }
+
+    ASDC_TRACE("rx_packet", packet->channel_id, packet->len);
+
+    if (packet->flags & ASDC_PACKET_FLAG_FRAGMENT) {
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION)
+        asdc_on_fragment_received(dev, peer, packet);
+#else
+        LOG_ERR("Received asdc fragment on device %s but fragmentation is disabled", dev->name);
+#endif
+        return;
+    }
+
+    size_t len;
+    uint8_t *data_copy = asdc_rx_payload(dev, packet->flags, packet->data, packet->len, &len);
     if (!data_copy) {
-        LOG_ERR("Failed to allocate memory for received asdc data");
+        asdc_credit_consumed(dev, peer, packet->seq);
         return;
     }
-    memcpy(data_copy, packet->data, packet->len);
 
+    asdc_queue_rx_block(dev, peer, packet->seq, data_copy, len);
+}
+
+void asdc_on_data_received(uint8_t peer, uint8_t *data, size_t len)
+{
+    LOG_DBG("asdc received %zu bytes", len);
+
+    while (len > 0) {
+        struct asdc_wire_packet packet;
+        int header_len = asdc_parse_packet(data, len, &packet);
+        if (header_len < 0) {
+            return;
+        }
+
+        asdc_on_packet_received(peer, &packet);
+
+        size_t packet_size = header_len + packet.len;
+        data += packet_size;
+        len -= packet_size;
+    }
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_ZERO_COPY)
+int asdc_on_data_received_buf(uint8_t peer, void *rx_ctx, struct net_buf *buf)
+{
+    struct asdc_wire_packet packet;
+    int header_len = asdc_parse_packet(buf->data, buf->len, &packet);
+    if (header_len < 0) {
+        return 0;
+    }
+
+    // batched packets, fragments, control messages and compressed data are copied, buf goes
+    // straight back to the transport
+    if (header_len + packet.len != buf->len ||
+        (packet.flags & (ASDC_PACKET_FLAG_FRAGMENT | ASDC_PACKET_FLAG_CONTROL |
+                         ASDC_PACKET_FLAG_CODEC_MASK))) {
+        asdc_on_data_received(peer, buf->data, buf->len);
+        return 0;
+    }
+
+    const struct device *dev = find_dev_for_channel_id(packet.channel_id);
+    if (!dev) {
+        LOG_ERR("No device found for asdc channel ID %d", packet.channel_id);
+        return 0;
+    }
+
+    // reliable channels may hold messages back for reordering, which would tie up buf, delta
+    // channels pass on a snapshot of their own and inline ones are done with it right away
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    if (cfg->reliable || cfg->mode == ASDC_MODE_DELTA ||
+        cfg->rx_dispatch == ASDC_RX_DISPATCH_INLINE) {
+        asdc_on_data_received(peer, buf->data, buf->len);
+        return 0;
+    }
+
+    ASDC_TRACE("rx_packet", packet.channel_id, packet.len);
+
+    // the transport hands over its reference to buf once we return -EINPROGRESS
     struct asdc_rx_event ev = {
         .dev = dev,
-        .len = packet->len,
-        .data = data_copy,
-        .conn = conn,
+        .len = packet.len,
+        .data = packet.data,
+        .peer = peer,
+        .seq = packet.seq,
+        .buf = buf,
+        .rx_ctx = rx_ctx,
     };
-    int ret = k_msgq_put(&asdc_rx_msgq, &ev, K_NO_WAIT);
+    int ret = asdc_rx_dispatch(&ev);
     if (ret < 0) {
-        free(data_copy);
-        LOG_ERR("Failed to queue received asdc data on device %s: %d", dev->name, ret);
+        ASDC_STAT_INC(dev, rx_dropped);
+        asdc_credit_consumed(dev, peer, packet.seq);
+        LOG_DBG("Failed to queue received asdc data on device %s: %d", dev->name, ret);
+        return 0;
+    }
+    return -EINPROGRESS;
+}
+#endif
+
+void asdc_on_peer_connected(uint8_t peer)
+{
+    if (peer >= ASDC_MAX_PEERS) {
         return;
     }
-    k_work_submit(&asdc_rx_work);
+
+    // the peer starts over with its sequence numbers as well
+    asdc_credit_reset(peer);
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    asdc_reliable_connected(peer);
+#endif
+    atomic_set_bit(&asdc_peers_connected, peer);
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER)
+    // the peer may run other firmware than before, it gets legacy headers until it says otherwise
+    atomic_clear_bit(&asdc_peers_compact, peer);
+    asdc_send_hello(peer);
+#endif
+    asdc_retain_replay(peer);
+    asdc_delta_connected(peer);
+    // the new connection is asked for the current link parameters on the next sample
+    asdc_link_wake();
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_channels); i++) {
+        asdc_tx_space_freed(asdc_channels[i]);
+    }
+}
+
+void asdc_on_peer_disconnected(uint8_t peer)
+{
+    if (peer >= ASDC_MAX_PEERS) {
+        return;
+    }
+
+    atomic_clear_bit(&asdc_peers_connected, peer);
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER)
+    atomic_clear_bit(&asdc_peers_compact, peer);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    asdc_reliable_disconnected(peer);
+#endif
+
+    // senders waiting for credits of the peer fail with -ENOTCONN now
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_channels); i++) {
+        struct asdc_data *asdc_data = (struct asdc_data *)asdc_channels[i]->data;
+        k_sem_give(&asdc_data->tx_space);
+    }
 }
 
 static void asdc_reg_recv_cb(const struct device *dev, asdc_rx_cb cb)
@@ -183,24 +1673,217 @@ static void asdc_reg_recv_cb(const struct device *dev, asdc_rx_cb cb)
     asdc_data->recv_cb = cb;
 }
 
+static void asdc_reg_tx_ready_cb(const struct device *dev, asdc_tx_ready_cb cb)
+{
+    struct asdc_data *asdc_data = (struct asdc_data *)dev->data;
+    asdc_data->tx_ready_cb = cb;
+}
+
+int asdc_get_stats(const struct device *dev, struct asdc_stats *stats)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+    struct asdc_counters *c = &((struct asdc_data *)dev->data)->counters;
+
+    stats->tx_messages = atomic_get(&c->tx_messages);
+    stats->tx_bytes = atomic_get(&c->tx_bytes);
+    stats->tx_dropped = atomic_get(&c->tx_dropped);
+    stats->tx_mtu_rejects = atomic_get(&c->tx_mtu_rejects);
+    stats->tx_alloc_failures = atomic_get(&c->tx_alloc_failures);
+    stats->tx_max_queue_depth = atomic_get(&c->tx_max_queue_depth);
+    for (size_t i = 0; i < ASDC_STATS_LATENCY_BUCKETS; i++) {
+        stats->tx_latency[i] = atomic_get(&c->tx_latency[i]);
+    }
+    stats->tx_retransmits = atomic_get(&c->tx_retransmits);
+    stats->rx_messages = atomic_get(&c->rx_messages);
+    stats->rx_bytes = atomic_get(&c->rx_bytes);
+    stats->rx_dropped = atomic_get(&c->rx_dropped);
+    stats->rx_alloc_failures = atomic_get(&c->rx_alloc_failures);
+    stats->rx_duplicates = atomic_get(&c->rx_duplicates);
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+#if !IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_MANAGER)
+int asdc_link_get_stats(struct asdc_link_stats *stats)
+{
+    return -ENOTSUP;
+}
+#endif
+
+void asdc_reset_stats(const struct device *dev)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+    // the counters are nothing but atomics
+    atomic_t *counters = (atomic_t *)&((struct asdc_data *)dev->data)->counters;
+    for (size_t i = 0; i < sizeof(struct asdc_counters) / sizeof(atomic_t); i++) {
+        atomic_clear(&counters[i]);
+    }
+#endif
+}
+
 static const struct asdc_driver_api asdc_api = {
     .send = &asdc_send_data,
+    .send_to = &asdc_send_data_to,
+    .send_timeout = &asdc_send_data_timeout,
+    .register_tx_ready_cb = &asdc_reg_tx_ready_cb,
     .register_recv_cb = &asdc_reg_recv_cb,
+    .tx_reserve = &asdc_reserve_tx_data,
+    .tx_commit = &asdc_commit_tx_data,
+    .tx_abort = &asdc_abort_tx_data,
 };
 
 //
 // Define config structs for each instance
 //
 
+#define ASDC_MODE(n) ((enum asdc_channel_mode)DT_INST_ENUM_IDX(n, mode))
+#define ASDC_RX_DISPATCH(n) ((enum asdc_rx_dispatch)DT_INST_ENUM_IDX(n, rx_dispatch))
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+#define ASDC_RELIABLE_MAX_CREDITS ASDC_RELIABLE_WINDOW
+#else
+#define ASDC_RELIABLE_MAX_CREDITS 0
+#endif
+
+#define ASDC_TX_QUEUE_DEPTH(n)                                                  \
+    (ASDC_MODE(n) == ASDC_MODE_COALESCING ? ASDC_COALESCING_SLOTS :             \
+     DT_INST_PROP(n, queue_depth) > 0 ? DT_INST_PROP(n, queue_depth)            \
+                                      : CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE)
+
+// inline channels pass messages on without queueing them
+#define ASDC_RX_QUEUE_DEPTH(n)                                                  \
+    (ASDC_RX_DISPATCH(n) == ASDC_RX_DISPATCH_INLINE ? 1 :                       \
+     DT_INST_PROP(n, rx_queue_depth) > 0 ? DT_INST_PROP(n, rx_queue_depth)      \
+                                         : CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_QUEUE_SIZE)
+
+// a channel's own blocks hold every packet its queue can take, the one being sent and those
+// a reliable channel keeps until they are acknowledged
+#define ASDC_POOL_BLOCKS(n)                                                     \
+    (ASDC_TX_QUEUE_DEPTH(n) + 1 +                                               \
+     (DT_INST_PROP(n, reliable) ? DT_INST_PROP(n, tx_credits) * ASDC_MAX_PEERS : 0))
+
 #define ASDC_CFG_DEFINE(n)                                                      \
+    BUILD_ASSERT(DT_INST_PROP(n, channel_id) >= 0 &&                            \
+                 DT_INST_PROP(n, channel_id) <=                                 \
+                 CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_MAX_CHANNEL_ID,        \
+                 "asdc channel-id out of range, see "                           \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_MAX_CHANNEL_ID");     \
+    BUILD_ASSERT(!IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER) || \
+                 !(DT_INST_PROP(n, channel_id) & ASDC_WIRE_COMPACT),            \
+                 "asdc channel-id cannot have bit 7 set with "                  \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPACT_HEADER");     \
+    BUILD_ASSERT(DT_INST_PROP(n, tx_credits) >= 0 &&                            \
+                 DT_INST_PROP(n, tx_credits) <= 127,                            \
+                 "asdc tx-credits must be between 0 and 127");                  \
+    BUILD_ASSERT(!DT_INST_PROP(n, reliable) ||                                  \
+                 IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE),  \
+                 "asdc reliable channels need "                                 \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE");           \
+    BUILD_ASSERT(!DT_INST_PROP(n, reliable) ||                                  \
+                 (DT_INST_PROP(n, tx_credits) > 0 &&                            \
+                  DT_INST_PROP(n, tx_credits) <= ASDC_RELIABLE_MAX_CREDITS),    \
+                 "asdc reliable channels need tx-credits between 1 and "        \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE_MAX_WINDOW");\
+    BUILD_ASSERT(!DT_INST_PROP(n, reliable) ||                                  \
+                 ASDC_MODE(n) != ASDC_MODE_COALESCING,                          \
+                 "asdc reliable channels cannot be coalescing");                \
+    BUILD_ASSERT(!DT_INST_PROP(n, compress) ||                                  \
+                 IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION), \
+                 "asdc compressed channels need "                               \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION");        \
+    BUILD_ASSERT((ASDC_MODE(n) == ASDC_MODE_DELTA) ==                           \
+                 (DT_INST_PROP(n, snapshot_size) > 0),                          \
+                 "asdc channels need a snapshot-size in delta mode and only "   \
+                 "in delta mode");                                              \
+    BUILD_ASSERT(DT_INST_PROP(n, max_payload_size) >= 0 &&                      \
+                 DT_INST_PROP(n, max_payload_size) <= UINT16_MAX,               \
+                 "asdc max-payload-size must be between 0 and 65535");          \
+    BUILD_ASSERT(ASDC_MODE(n) != ASDC_MODE_DELTA ||                             \
+                 DT_INST_PROP(n, max_payload_size) == 0 ||                      \
+                 DT_INST_PROP(n, max_payload_size) >=                           \
+                 DT_INST_PROP(n, snapshot_size) + sizeof(struct asdc_delta_header), \
+                 "asdc max-payload-size of delta channels must leave room for " \
+                 "snapshot-size and a 3 byte header");                          \
+    BUILD_ASSERT(DT_INST_PROP(n, snapshot_size) <= UINT16_MAX,                  \
+                 "asdc snapshot-size must be at most 65535");                   \
+    BUILD_ASSERT(ASDC_MODE(n) != ASDC_MODE_DELTA ||                             \
+                 DT_INST_PROP(n, retain_count) == 0,                            \
+                 "asdc delta channels send their snapshot on reconnect, "       \
+                 "retain-count cannot be used with them");                      \
+    BUILD_ASSERT(DT_INST_PROP(n, retain_count) >= 0 &&                          \
+                 DT_INST_PROP(n, retain_count) <= 255,                          \
+                 "asdc retain-count must be between 0 and 255");                \
+    BUILD_ASSERT(DT_INST_PROP(n, retain_key_size) >= 0 &&                       \
+                 DT_INST_PROP(n, retain_key_size) <= 255,                       \
+                 "asdc retain-key-size must be between 0 and 255");             \
+    BUILD_ASSERT(!DT_INST_PROP(n, reliable) ||                                  \
+                 DT_INST_PROP(n, retain_count) == 0,                            \
+                 "asdc reliable channels deliver across reconnects already, "   \
+                 "retain-count would duplicate messages");                      \
+    BUILD_ASSERT(DT_INST_PROP(n, l2cap_channel) >= 0 &&                         \
+                 DT_INST_PROP(n, l2cap_channel) < ASDC_L2CAP_CHANNELS,          \
+                 "asdc l2cap-channel must be below "                            \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_L2CAP_CHANNELS");     \
+    BUILD_ASSERT(DT_INST_PROP(n, rx_queue_depth) >= 0,                          \
+                 "asdc rx-queue-depth must not be negative");                   \
+    BUILD_ASSERT(ASDC_RX_DISPATCH(n) != ASDC_RX_DISPATCH_THREAD ||              \
+                 IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD), \
+                 "asdc channels with rx-dispatch = \"thread\" need "            \
+                 "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_THREAD");          \
+    BUILD_ASSERT(!DT_INST_PROP(n, reliable) ||                                  \
+                 ASDC_RX_DISPATCH(n) != ASDC_RX_DISPATCH_INLINE,                \
+                 "asdc reliable channels pass messages on under a lock, "       \
+                 "they cannot use rx-dispatch = \"inline\"");                   \
+    COND_CODE_0(DT_INST_PROP(n, retain_count), (),                              \
+                (static struct asdc_retained_msg                                \
+                     asdc_retained_##n[DT_INST_PROP(n, retain_count)];))        \
+    COND_CODE_0(DT_INST_PROP(n, snapshot_size), (),                             \
+                (static uint8_t asdc_snapshots_##n                              \
+                     [(1 + ASDC_MAX_PEERS) * DT_INST_PROP(n, snapshot_size)];)) \
+    COND_CODE_0(DT_INST_PROP(n, max_payload_size), (),                          \
+                (ASDC_POOL_CLASS_DEFINE(asdc_pool_##n,                          \
+                     sizeof(struct asdc_packet) + DT_INST_PROP(n, max_payload_size), \
+                     ASDC_POOL_BLOCKS(n))))                                     \
+    K_MSGQ_DEFINE(asdc_tx_msgq_##n, sizeof(struct asdc_tx_event),               \
+                  ASDC_TX_QUEUE_DEPTH(n), 1);                                   \
+    K_MSGQ_DEFINE(asdc_rx_msgq_##n, sizeof(struct asdc_rx_event),               \
+                  ASDC_RX_QUEUE_DEPTH(n), 1);                                   \
     static const struct asdc_config config_##n = {                              \
         .channel_id = DT_INST_PROP(n, channel_id),                              \
+        .priority = DT_INST_PROP(n, priority),                                  \
+        .l2cap_channel = DT_INST_PROP(n, l2cap_channel),                        \
+        .mode = ASDC_MODE(n),                                                   \
+        .tx_credits = DT_INST_PROP(n, tx_credits),                              \
+        .reliable = DT_INST_PROP(n, reliable),                                  \
+        .compress = DT_INST_PROP(n, compress),                                  \
+        .retain_count = DT_INST_PROP(n, retain_count),                          \
+        .retain_key_size = DT_INST_PROP(n, retain_key_size),                    \
+        .retained = COND_CODE_0(DT_INST_PROP(n, retain_count), (NULL),          \
+                                (asdc_retained_##n)),                           \
+        .snapshot_size = DT_INST_PROP(n, snapshot_size),                        \
+        .snapshots = COND_CODE_0(DT_INST_PROP(n, snapshot_size), (NULL),        \
+                                 (asdc_snapshots_##n)),                         \
+        .max_payload_size = DT_INST_PROP(n, max_payload_size),                  \
+        .pool = COND_CODE_0(DT_INST_PROP(n, max_payload_size), (NULL),          \
+                            (&asdc_pool_##n)),                                  \
+        .tx_msgq = &asdc_tx_msgq_##n,                                           \
+        .rx_dispatch = ASDC_RX_DISPATCH(n),                                     \
+        .rx_msgq = &asdc_rx_msgq_##n,                                           \
     };
 
 DT_INST_FOREACH_STATUS_OKAY(ASDC_CFG_DEFINE)
 
 #define ASDC_DEVICE_DEFINE(n)                                                   \
-    static struct asdc_data asdc_data_##n;                                      \
+    static struct asdc_data asdc_data_##n = {                                   \
+        /* initialized statically, transports may signal it before asdc_init */ \
+        .tx_space = Z_SEM_INITIALIZER(asdc_data_##n.tx_space, 0, 1),            \
+        .dev = DEVICE_DT_INST_GET(n),                                           \
+        .rx_work = Z_WORK_INITIALIZER(asdc_rx_work_callback),                   \
+        .subscribers = SYS_SLIST_STATIC_INIT(&asdc_data_##n.subscribers),       \
+        .sub_lock = Z_MUTEX_INITIALIZER(asdc_data_##n.sub_lock),                \
+    };                                                                          \
     DEVICE_DT_INST_DEFINE(n, asdc_init, NULL, &asdc_data_##n,                   \
                           &config_##n, POST_KERNEL,                             \
                           CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, &asdc_api);
@@ -0,0 +1,283 @@
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+
+#include <arbitrary_split_data_channel.h>
+
+// Payload codecs. Both are byte oriented, need no working memory on the decoding side and only
+// a small hash table when encoding LZF. The decoders are always built, so that a peer can send
+// compressed data to a receiver without CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION.
+
+//
+// LZF, the format of liblzf. A control byte below 32 is followed by that many plus one literal
+// bytes. Otherwise its top 3 bits are the match length minus 2, 7 meaning another byte with
+// the rest of the length follows, and its low 5 bits and the next byte are the distance minus 1
+// back into the output.
+//
+
+#define ASDC_LZF_MAX_LITERAL 32
+#define ASDC_LZF_MAX_OFFSET 8192
+#define ASDC_LZF_MAX_MATCH (255 + 7 + 2)
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+#define ASDC_LZF_HASH_BITS CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LZF_HASH_BITS
+
+// positions plus one of the last occurrence of each hashed 3 byte sequence, 0 for none
+static uint16_t asdc_lzf_htab[1 << ASDC_LZF_HASH_BITS];
+static K_MUTEX_DEFINE(asdc_lzf_lock);
+
+static inline uint32_t asdc_lzf_hash(const uint8_t *p)
+{
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return ((v * 2654435761u) >> (32 - ASDC_LZF_HASH_BITS)) & ((1 << ASDC_LZF_HASH_BITS) - 1);
+}
+
+static int asdc_lzf_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    const uint8_t *ip = in;
+    const uint8_t *in_end = in + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = out + out_len;
+
+    if (in_len > UINT16_MAX || out_len == 0) {
+        return -ENOSPC;
+    }
+
+    memset(asdc_lzf_htab, 0, sizeof(asdc_lzf_htab));
+
+    // control byte of the literal run being collected
+    uint8_t *lit_ctrl = op++;
+    size_t lit = 0;
+
+    while (ip < in_end) {
+        if (in_end - ip >= 3) {
+            uint32_t h = asdc_lzf_hash(ip);
+            const uint8_t *ref = asdc_lzf_htab[h] ? in + asdc_lzf_htab[h] - 1 : NULL;
+            asdc_lzf_htab[h] = ip - in + 1;
+
+            if (ref && ip - ref <= ASDC_LZF_MAX_OFFSET && memcmp(ref, ip, 3) == 0) {
+                size_t max = MIN((size_t)(in_end - ip), ASDC_LZF_MAX_MATCH);
+                size_t len = 3;
+                while (len < max && ref[len] == ip[len]) {
+                    len++;
+                }
+
+                // close the literal run, or drop its control byte if it is empty
+                if (lit > 0) {
+                    *lit_ctrl = lit - 1;
+                } else {
+                    op--;
+                }
+
+                // the match takes up to 3 bytes, plus the control byte of the next literal run
+                if (out_end - op < 4) {
+                    return -ENOSPC;
+                }
+
+                size_t off = ip - ref - 1;
+                size_t l = len - 2;
+                if (l < 7) {
+                    *op++ = (l << 5) | (off >> 8);
+                } else {
+                    *op++ = (7 << 5) | (off >> 8);
+                    *op++ = l - 7;
+                }
+                *op++ = off & 0xff;
+
+                ip += len;
+                lit_ctrl = op++;
+                lit = 0;
+                continue;
+            }
+        }
+
+        if (op >= out_end) {
+            return -ENOSPC;
+        }
+        *op++ = *ip++;
+        if (++lit == ASDC_LZF_MAX_LITERAL) {
+            *lit_ctrl = lit - 1;
+            if (op >= out_end) {
+                return -ENOSPC;
+            }
+            lit_ctrl = op++;
+            lit = 0;
+        }
+    }
+
+    if (lit > 0) {
+        *lit_ctrl = lit - 1;
+    } else {
+        op--;
+    }
+
+    return op - out;
+}
+#endif
+
+static int asdc_lzf_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    const uint8_t *ip = in;
+    const uint8_t *in_end = in + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = out + out_len;
+
+    while (ip < in_end) {
+        size_t ctrl = *ip++;
+
+        if (ctrl < ASDC_LZF_MAX_LITERAL) {
+            size_t n = ctrl + 1;
+            if (n > (size_t)(in_end - ip) || n > (size_t)(out_end - op)) {
+                return -EINVAL;
+            }
+            memcpy(op, ip, n);
+            op += n;
+            ip += n;
+            continue;
+        }
+
+        size_t len = ctrl >> 5;
+        if (len == 7) {
+            if (ip >= in_end) {
+                return -EINVAL;
+            }
+            len += *ip++;
+        }
+        if (ip >= in_end) {
+            return -EINVAL;
+        }
+        size_t off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+        len += 2;
+
+        if (off > (size_t)(op - out) || len > (size_t)(out_end - op)) {
+            return -EINVAL;
+        }
+
+        // byte by byte, the match may overlap what it produces
+        const uint8_t *ref = op - off;
+        while (len--) {
+            *op++ = *ref++;
+        }
+    }
+
+    return op - out;
+}
+
+//
+// Run-length encoding. A control byte with the top bit set is followed by one byte repeated
+// its low 7 bits plus 3 times, otherwise by that many plus one literal bytes.
+//
+
+#define ASDC_RLE_RUN BIT(7)
+#define ASDC_RLE_MIN_RUN 3
+#define ASDC_RLE_MAX_RUN (0x7f + ASDC_RLE_MIN_RUN)
+#define ASDC_RLE_MAX_LITERAL 128
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+static int asdc_rle_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < in_len) {
+        size_t run = 1;
+        while (i + run < in_len && in[i + run] == in[i] && run < ASDC_RLE_MAX_RUN) {
+            run++;
+        }
+
+        if (run >= ASDC_RLE_MIN_RUN) {
+            if (out_len - o < 2) {
+                return -ENOSPC;
+            }
+            out[o++] = ASDC_RLE_RUN | (run - ASDC_RLE_MIN_RUN);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        // literals up to the next run worth encoding
+        size_t start = i;
+        while (i < in_len && i - start < ASDC_RLE_MAX_LITERAL) {
+            if (i + 2 < in_len && in[i] == in[i + 1] && in[i] == in[i + 2]) {
+                break;
+            }
+            i++;
+        }
+
+        size_t n = i - start;
+        if (out_len - o < n + 1) {
+            return -ENOSPC;
+        }
+        out[o++] = n - 1;
+        memcpy(&out[o], &in[start], n);
+        o += n;
+    }
+
+    return o;
+}
+#endif
+
+static int asdc_rle_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < in_len) {
+        uint8_t ctrl = in[i++];
+
+        if (ctrl & ASDC_RLE_RUN) {
+            size_t n = (ctrl & ~ASDC_RLE_RUN) + ASDC_RLE_MIN_RUN;
+            if (i >= in_len || n > out_len - o) {
+                return -EINVAL;
+            }
+            memset(&out[o], in[i++], n);
+            o += n;
+        } else {
+            size_t n = ctrl + 1;
+            if (n > in_len - i || n > out_len - o) {
+                return -EINVAL;
+            }
+            memcpy(&out[o], &in[i], n);
+            i += n;
+            o += n;
+        }
+    }
+
+    return o;
+}
+
+int asdc_compress(enum asdc_codec codec, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_COMPRESSION)
+    int ret;
+
+    switch (codec) {
+    case ASDC_CODEC_LZF:
+        k_mutex_lock(&asdc_lzf_lock, K_FOREVER);
+        ret = asdc_lzf_compress(in, in_len, out, out_len);
+        k_mutex_unlock(&asdc_lzf_lock);
+        return ret;
+    case ASDC_CODEC_RLE:
+        return asdc_rle_compress(in, in_len, out, out_len);
+    default:
+        return -ENOTSUP;
+    }
+#else
+    return -ENOTSUP;
+#endif
+}
+
+int asdc_decompress(enum asdc_codec codec, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    switch (codec) {
+    case ASDC_CODEC_LZF:
+        return asdc_lzf_decompress(in, in_len, out, out_len);
+    case ASDC_CODEC_RLE:
+        return asdc_rle_decompress(in, in_len, out, out_len);
+    default:
+        return -ENOTSUP;
+    }
+}
@@ -0,0 +1,230 @@
+#define DT_DRV_COMPAT zmk_arbitrary_split_data_channel
+
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/device.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Credit based flow control of channels with the tx-credits property. Every message a channel
+// sends to a peer carries a sequence number, and at most tx-credits of them may be unconsumed by
+// the receiver. The receiver reports the sequence number of the last message it consumed with a
+// credit control message. Reports are cumulative, so a lost message or report is made good by
+// the next one.
+//
+// Reliable channels use the same window, but it is advanced by their acks instead, see
+// arbitrary_split_data_channel_reliable.c.
+
+#define ASDC_CREDIT_RETRY_MS 10
+
+#define ASDC_CREDIT_CHANNEL_DEV(n) DEVICE_DT_INST_GET(n),
+static const struct device *const asdc_credit_channels[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_CREDIT_CHANNEL_DEV)
+};
+
+static struct k_spinlock asdc_credit_lock;
+
+static void asdc_credit_work_callback(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(asdc_credit_work, asdc_credit_work_callback);
+
+static uint8_t asdc_credit_window(const struct device *dev)
+{
+    return ((const struct asdc_config *)dev->config)->tx_credits;
+}
+
+static bool asdc_credit_reliable(const struct device *dev)
+{
+    return ((const struct asdc_config *)dev->config)->reliable;
+}
+
+// a broadcast on a single-peer build goes to peer 0, other broadcasts are split up by the sender
+static struct asdc_credit_state *asdc_credit_state(const struct device *dev, uint8_t peer)
+{
+    if (peer == ASDC_PEER_BROADCAST && ASDC_MAX_PEERS == 1) {
+        peer = 0;
+    }
+    if (peer >= ASDC_MAX_PEERS) {
+        return NULL;
+    }
+    return &((struct asdc_data *)dev->data)->credits[peer];
+}
+
+bool asdc_credit_take(const struct device *dev, uint8_t peer, struct asdc_packet *packet)
+{
+    uint8_t window = asdc_credit_window(dev);
+    if (window == 0) {
+        return true;
+    }
+
+    struct asdc_credit_state *cs = asdc_credit_state(dev, peer);
+    if (!cs) {
+        return false;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE)
+    // the sequence numbers towards a reconnected peer are only known once it sent its state
+    if (asdc_credit_reliable(dev) && !asdc_reliable_tx_synced(dev, peer)) {
+        return false;
+    }
+#endif
+
+    bool taken = true;
+    int64_t now = k_uptime_get();
+    k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+
+    uint8_t outstanding = cs->tx_seq - cs->tx_acked;
+    if (outstanding >= window) {
+        // reliable channels retransmit instead of giving up on the outstanding messages
+        if (asdc_credit_reliable(dev) ||
+            now - cs->tx_progress_at < CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_CREDIT_TIMEOUT_MS) {
+            taken = false;
+            goto unlock;
+        }
+        // the peer went quiet with the whole window outstanding, its reports must have been lost
+        LOG_WRN("asdc credits of device %s timed out, resetting the window", dev->name);
+        cs->tx_acked = cs->tx_seq;
+        outstanding = 0;
+    }
+
+    if (outstanding == 0) {
+        cs->tx_progress_at = now;
+    }
+    packet->seq = ++cs->tx_seq;
+
+unlock:
+    k_spin_unlock(&asdc_credit_lock, key);
+    return taken;
+}
+
+void asdc_credit_untake(const struct device *dev, uint8_t peer)
+{
+    struct asdc_credit_state *cs = asdc_credit_state(dev, peer);
+    if (asdc_credit_window(dev) == 0 || !cs) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+    cs->tx_seq--;
+    k_spin_unlock(&asdc_credit_lock, key);
+}
+
+void asdc_credit_consumed(const struct device *dev, uint8_t peer, uint8_t seq)
+{
+    uint8_t window = asdc_credit_window(dev);
+    struct asdc_credit_state *cs = asdc_credit_state(dev, peer);
+    // reliable channels acknowledge on receipt
+    if (window == 0 || asdc_credit_reliable(dev) || !cs) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+    cs->rx_seq = seq;
+    uint8_t unreported = cs->rx_seq - cs->rx_reported;
+    k_spin_unlock(&asdc_credit_lock, key);
+
+    // report in batches of half the window, so the sender never runs dry while we are below it
+    if (unreported >= MAX(window / 2, 1)) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_credit_work, K_NO_WAIT);
+    }
+}
+
+void asdc_credit_received(const struct device *dev, uint8_t peer, uint8_t seq)
+{
+    struct asdc_credit_state *cs = asdc_credit_state(dev, peer);
+    if (asdc_credit_window(dev) == 0 || !cs) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+    // ignore stale reports, they cannot acknowledge more than was sent
+    if ((uint8_t)(seq - cs->tx_acked) <= (uint8_t)(cs->tx_seq - cs->tx_acked)) {
+        cs->tx_acked = seq;
+        cs->tx_progress_at = k_uptime_get();
+    }
+    k_spin_unlock(&asdc_credit_lock, key);
+
+    asdc_tx_space_freed(dev);
+}
+
+void asdc_credit_reset(uint8_t peer)
+{
+    k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_credit_channels); i++) {
+        // reliable channels carry on where they left off, they resync on their own
+        if (asdc_credit_reliable(asdc_credit_channels[i])) {
+            continue;
+        }
+        struct asdc_credit_state *cs = asdc_credit_state(asdc_credit_channels[i], peer);
+        if (cs) {
+            *cs = (struct asdc_credit_state){0};
+        }
+    }
+    k_spin_unlock(&asdc_credit_lock, key);
+}
+
+void asdc_credit_resync(const struct device *dev, uint8_t peer, uint8_t seq)
+{
+    struct asdc_credit_state *cs = asdc_credit_state(dev, peer);
+    if (!cs) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+    cs->tx_seq = seq;
+    cs->tx_acked = seq;
+    cs->tx_progress_at = k_uptime_get();
+    k_spin_unlock(&asdc_credit_lock, key);
+
+    asdc_tx_space_freed(dev);
+}
+
+static void asdc_credit_work_callback(struct k_work *work)
+{
+    bool retry = false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_credit_channels); i++) {
+        const struct device *dev = asdc_credit_channels[i];
+        if (asdc_credit_window(dev) == 0) {
+            continue;
+        }
+
+        for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+            struct asdc_credit_state *cs = asdc_credit_state(dev, peer);
+
+            k_spinlock_key_t key = k_spin_lock(&asdc_credit_lock);
+            uint8_t seq = cs->rx_seq;
+            bool unreported = seq != cs->rx_reported;
+            k_spin_unlock(&asdc_credit_lock, key);
+
+            if (!unreported || !asdc_peer_is_connected(peer)) {
+                continue;
+            }
+
+            struct asdc_ctrl_credit msg = {
+                .type = ASDC_CTRL_CREDIT,
+                .seq = seq,
+            };
+            if (asdc_queue_control(dev, peer, &msg, sizeof(msg)) < 0) {
+                retry = true;
+                continue;
+            }
+
+            key = k_spin_lock(&asdc_credit_lock);
+            cs->rx_reported = seq;
+            k_spin_unlock(&asdc_credit_lock, key);
+        }
+    }
+
+    if (retry) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_credit_work, K_MSEC(ASDC_CREDIT_RETRY_MS));
+    }
+}
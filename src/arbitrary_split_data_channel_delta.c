@@ -0,0 +1,383 @@
+#define DT_DRV_COMPAT zmk_arbitrary_split_data_channel
+
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/device.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Channels in delta mode keep the snapshot they sent last and only send the byte ranges that
+// changed since, the receiver applies them to its own copy and passes the whole snapshot to the
+// recv callback. Snapshots are numbered and a delta names the one it applies to. A receiver
+// whose copy is of another generation, because a message got lost on the way, drops the delta
+// and asks for a full snapshot. Peers that connect get one without asking.
+//
+// A delta is a series of ranges, each a byte with the number of unchanged bytes to skip, a byte
+// with the number of changed bytes and those bytes. Bytes after the last range are unchanged.
+
+#define ASDC_DELTA_RETRY_MS 10
+// how long a receiver waits for the full snapshot it asked for before asking again
+#define ASDC_DELTA_RESYNC_INTERVAL_MS 100
+#define ASDC_DELTA_MAX_RUN UINT8_MAX
+// a new range costs 2 bytes, so shorter unchanged gaps are sent along with the changed bytes
+#define ASDC_DELTA_MIN_GAP 3
+
+#define ASDC_DELTA_CHANNEL_DEV(n) DEVICE_DT_INST_GET(n),
+static const struct device *const asdc_delta_channels[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_DELTA_CHANNEL_DEV)
+};
+
+static struct k_spinlock asdc_delta_lock;
+
+static void asdc_delta_work_callback(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(asdc_delta_work, asdc_delta_work_callback);
+
+static bool asdc_delta_channel(const struct device *dev)
+{
+    return ((const struct asdc_config *)dev->config)->mode == ASDC_MODE_DELTA;
+}
+
+static uint8_t *asdc_delta_rx_snapshot(const struct device *dev, uint8_t peer)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    return cfg->snapshots + (1 + peer) * cfg->snapshot_size;
+}
+
+// true if one of the ASDC_DELTA_MIN_GAP bytes from pos on changed
+static bool asdc_delta_changed_near(const uint8_t *old, const uint8_t *new, size_t len, size_t pos)
+{
+    for (size_t i = pos; i < MIN(pos + ASDC_DELTA_MIN_GAP, len); i++) {
+        if (old[i] != new[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// writes the ranges that turn old into new to out, -ENOSPC if they need more than out_len bytes
+static int asdc_delta_diff(const uint8_t *old, const uint8_t *new, size_t len, uint8_t *out, size_t out_len)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < len) {
+        size_t skip = 0;
+        while (i + skip < len && old[i + skip] == new[i + skip] && skip < ASDC_DELTA_MAX_RUN) {
+            skip++;
+        }
+        if (i + skip == len) {
+            break;
+        }
+
+        // a skip longer than a byte can hold continues with an empty range
+        size_t start = i + skip;
+        size_t end = start;
+        while (end < len && end - start < ASDC_DELTA_MAX_RUN &&
+               asdc_delta_changed_near(old, new, len, end)) {
+            end++;
+        }
+
+        if (out_len - o < 2 + (end - start)) {
+            return -ENOSPC;
+        }
+        out[o++] = skip;
+        out[o++] = end - start;
+        memcpy(&out[o], &new[start], end - start);
+        o += end - start;
+        i = end;
+    }
+
+    return o;
+}
+
+static int asdc_delta_patch(uint8_t *state, size_t len, const uint8_t *delta, size_t delta_len)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while (o < delta_len) {
+        if (delta_len - o < 2) {
+            return -EINVAL;
+        }
+        size_t skip = delta[o++];
+        size_t count = delta[o++];
+        if (count > delta_len - o || skip + count > len - i) {
+            return -EINVAL;
+        }
+        i += skip;
+        memcpy(&state[i], &delta[o], count);
+        i += count;
+        o += count;
+    }
+
+    return 0;
+}
+
+int asdc_delta_encode(const struct device *dev, const uint8_t *data, size_t len, uint8_t **msg)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_delta_state *ds = &((struct asdc_data *)dev->data)->delta;
+
+    if (len == 0) {
+        return -EINVAL;
+    }
+    if (len > cfg->snapshot_size) {
+        LOG_ERR("asdc data of %zu bytes exceeds the snapshot-size of device %s", len, dev->name);
+        return -EMSGSIZE;
+    }
+
+    uint8_t *out = asdc_pool_alloc(sizeof(struct asdc_delta_header) + len);
+    if (!out) {
+        return -ENOMEM;
+    }
+    struct asdc_delta_header *hdr = (struct asdc_delta_header *)out;
+    uint8_t *payload = out + sizeof(*hdr);
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_delta_lock);
+
+    // a delta has to be smaller than the snapshot to be worth it
+    int ret = -ENOSPC;
+    if (ds->tx_len == len) {
+        ret = asdc_delta_diff(cfg->snapshots, data, len, payload, len - 1);
+    }
+
+    hdr->flags = 0;
+    hdr->base = ds->tx_gen;
+    hdr->gen = ++ds->tx_gen;
+    if (ret < 0) {
+        hdr->flags = ASDC_DELTA_FLAG_FULL;
+        memcpy(payload, data, len);
+        ret = len;
+    }
+
+    memcpy(cfg->snapshots, data, len);
+    ds->tx_len = len;
+
+    k_spin_unlock(&asdc_delta_lock, key);
+
+    *msg = out;
+    return sizeof(*hdr) + ret;
+}
+
+void asdc_delta_unsent(const struct device *dev, uint8_t peer)
+{
+    if (!asdc_delta_channel(dev)) {
+        return;
+    }
+
+    struct asdc_delta_state *ds = &((struct asdc_data *)dev->data)->delta;
+
+    // the snapshot moved on without the peer, it needs a full one
+    k_spinlock_key_t key = k_spin_lock(&asdc_delta_lock);
+    for (uint8_t p = 0; p < ASDC_MAX_PEERS; p++) {
+        if (peer == ASDC_PEER_BROADCAST || peer == p) {
+            ds->tx_push[p] = true;
+        }
+    }
+    k_spin_unlock(&asdc_delta_lock, key);
+
+    k_work_schedule_for_queue(&asdc_work_q, &asdc_delta_work, K_MSEC(ASDC_DELTA_RETRY_MS));
+}
+
+int asdc_delta_decode(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len,
+                      uint8_t **state, size_t *state_len)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_delta_state *ds = &((struct asdc_data *)dev->data)->delta;
+
+    if (peer >= ASDC_MAX_PEERS || len < sizeof(struct asdc_delta_header)) {
+        return -EINVAL;
+    }
+
+    const struct asdc_delta_header *hdr = (const struct asdc_delta_header *)data;
+    const uint8_t *payload = data + sizeof(*hdr);
+    size_t payload_len = len - sizeof(*hdr);
+    bool full = hdr->flags & ASDC_DELTA_FLAG_FULL;
+
+    if (full && (payload_len == 0 || payload_len > cfg->snapshot_size)) {
+        LOG_ERR("Received asdc snapshot of %zu bytes on device %s", payload_len, dev->name);
+        return -EINVAL;
+    }
+
+    uint8_t *snapshot = asdc_delta_rx_snapshot(dev, peer);
+    bool request = false;
+    int ret = 0;
+    k_spinlock_key_t key = k_spin_lock(&asdc_delta_lock);
+
+    if (!full && (!ds->rx_valid[peer] || hdr->base != ds->rx_gen[peer])) {
+        int64_t now = k_uptime_get();
+        if (now - ds->rx_resync_at[peer] >= ASDC_DELTA_RESYNC_INTERVAL_MS) {
+            ds->rx_resync_at[peer] = now;
+            ds->rx_resync[peer] = true;
+            request = true;
+        }
+        ret = -ESTALE;
+        goto unlock;
+    }
+
+    size_t out_len = full ? payload_len : ds->rx_len[peer];
+    uint8_t *out = asdc_pool_alloc(out_len);
+    if (!out) {
+        ret = -ENOMEM;
+        goto unlock;
+    }
+
+    if (full) {
+        memcpy(out, payload, out_len);
+    } else {
+        memcpy(out, snapshot, out_len);
+        if (asdc_delta_patch(out, out_len, payload, payload_len) < 0) {
+            LOG_ERR("Received malformed asdc delta on device %s", dev->name);
+            asdc_pool_free(out);
+            ret = -EINVAL;
+            goto unlock;
+        }
+    }
+
+    memcpy(snapshot, out, out_len);
+    ds->rx_len[peer] = out_len;
+    ds->rx_gen[peer] = hdr->gen;
+    ds->rx_valid[peer] = true;
+
+    *state = out;
+    *state_len = out_len;
+
+unlock:
+    k_spin_unlock(&asdc_delta_lock, key);
+
+    if (request) {
+        LOG_DBG("asdc device %s is out of sync with peer %u", dev->name, peer);
+        k_work_reschedule_for_queue(&asdc_work_q, &asdc_delta_work, K_NO_WAIT);
+    }
+    return ret;
+}
+
+void asdc_delta_resync(const struct device *dev, uint8_t peer)
+{
+    if (!asdc_delta_channel(dev) || peer >= ASDC_MAX_PEERS) {
+        return;
+    }
+
+    struct asdc_delta_state *ds = &((struct asdc_data *)dev->data)->delta;
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_delta_lock);
+    ds->rx_valid[peer] = false;
+    ds->rx_resync_at[peer] = k_uptime_get();
+    ds->rx_resync[peer] = true;
+    k_spin_unlock(&asdc_delta_lock, key);
+
+    k_work_reschedule_for_queue(&asdc_work_q, &asdc_delta_work, K_NO_WAIT);
+}
+
+void asdc_delta_resync_received(const struct device *dev, uint8_t peer)
+{
+    asdc_delta_unsent(dev, peer);
+}
+
+void asdc_delta_connected(uint8_t peer)
+{
+    bool any = false;
+    k_spinlock_key_t key = k_spin_lock(&asdc_delta_lock);
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_delta_channels); i++) {
+        if (!asdc_delta_channel(asdc_delta_channels[i])) {
+            continue;
+        }
+        struct asdc_delta_state *ds = &((struct asdc_data *)asdc_delta_channels[i]->data)->delta;
+
+        // both sides start over, the peer sends its full snapshot without being asked
+        ds->tx_push[peer] = true;
+        ds->rx_valid[peer] = false;
+        ds->rx_resync[peer] = false;
+        ds->rx_resync_at[peer] = k_uptime_get();
+        any = true;
+    }
+
+    k_spin_unlock(&asdc_delta_lock, key);
+
+    if (any) {
+        k_work_reschedule_for_queue(&asdc_work_q, &asdc_delta_work, K_NO_WAIT);
+    }
+}
+
+// sends the current snapshot to peer, with the generation the next delta applies to
+static int asdc_delta_push(const struct device *dev, uint8_t peer)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_delta_state *ds = &((struct asdc_data *)dev->data)->delta;
+
+    uint8_t *msg = asdc_pool_alloc(sizeof(struct asdc_delta_header) + cfg->snapshot_size);
+    if (!msg) {
+        return -ENOMEM;
+    }
+    struct asdc_delta_header *hdr = (struct asdc_delta_header *)msg;
+
+    // held while queueing, so that no newer delta is queued ahead of the snapshot it applies to
+    k_spinlock_key_t key = k_spin_lock(&asdc_delta_lock);
+
+    int ret = 0;
+    if (ds->tx_len > 0) {
+        hdr->flags = ASDC_DELTA_FLAG_FULL;
+        hdr->base = ds->tx_gen;
+        hdr->gen = ds->tx_gen;
+        memcpy(msg + sizeof(*hdr), cfg->snapshots, ds->tx_len);
+        ret = asdc_queue_message(dev, peer, msg, sizeof(*hdr) + ds->tx_len);
+    }
+    if (ret == 0) {
+        ds->tx_push[peer] = false;
+    }
+
+    k_spin_unlock(&asdc_delta_lock, key);
+
+    asdc_pool_free(msg);
+    return ret;
+}
+
+static void asdc_delta_work_callback(struct k_work *work)
+{
+    bool retry = false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_delta_channels); i++) {
+        const struct device *dev = asdc_delta_channels[i];
+        if (!asdc_delta_channel(dev)) {
+            continue;
+        }
+        struct asdc_delta_state *ds = &((struct asdc_data *)dev->data)->delta;
+
+        for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+            if (!asdc_peer_is_connected(peer)) {
+                continue;
+            }
+
+            if (ds->tx_push[peer] && asdc_delta_push(dev, peer) < 0) {
+                // the channel's queue is full, the snapshot is sent once it drained a bit
+                retry = true;
+            }
+
+            if (ds->rx_resync[peer]) {
+                struct asdc_ctrl_resync msg = {
+                    .type = ASDC_CTRL_RESYNC,
+                };
+                if (asdc_queue_control(dev, peer, &msg, sizeof(msg)) < 0) {
+                    retry = true;
+                    continue;
+                }
+                ds->rx_resync[peer] = false;
+            }
+        }
+    }
+
+    if (retry) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_delta_work, K_MSEC(ASDC_DELTA_RETRY_MS));
+    }
+}
@@ -0,0 +1,216 @@
+
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/device.h>
+#include <zephyr/net/buf.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// prepended to the data of every packet flagged with ASDC_PACKET_FLAG_FRAGMENT,
+// all fields are little-endian
+struct asdc_frag_header {
+    uint16_t msg_id;
+    uint16_t offset;
+    uint16_t total_len;
+} __packed;
+
+BUILD_ASSERT(sizeof(struct asdc_frag_header) == ASDC_FRAG_HEADER_SIZE);
+
+struct asdc_reassembly_slot {
+    uint8_t peer;
+    uint16_t channel_id;
+    uint16_t msg_id;
+    uint16_t total_len;
+    uint16_t received;
+    int64_t deadline;
+    uint8_t *data;                  // pool block of total_len bytes, NULL if the slot is free
+};
+
+static struct asdc_reassembly_slot reassembly_slots[CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_REASSEMBLY_SLOTS];
+static struct k_spinlock reassembly_lock;
+static uint16_t next_msg_id;
+
+static void reassembly_timeout_work_callback(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(reassembly_timeout_work, reassembly_timeout_work_callback);
+
+static void reassembly_slot_free(struct asdc_reassembly_slot *slot)
+{
+    asdc_pool_free(slot->data);
+    slot->data = NULL;
+}
+
+static void reassembly_timeout_work_callback(struct k_work *work)
+{
+    int64_t now = k_uptime_get();
+    int64_t next_deadline = INT64_MAX;
+
+    k_spinlock_key_t key = k_spin_lock(&reassembly_lock);
+    for (size_t i = 0; i < ARRAY_SIZE(reassembly_slots); i++) {
+        struct asdc_reassembly_slot *slot = &reassembly_slots[i];
+        if (!slot->data) {
+            continue;
+        }
+        if (slot->deadline <= now) {
+            LOG_WRN("asdc reassembly of message %u on channel %u timed out (%u/%u bytes)",
+                    slot->msg_id, slot->channel_id, slot->received, slot->total_len);
+            reassembly_slot_free(slot);
+        } else {
+            next_deadline = MIN(next_deadline, slot->deadline);
+        }
+    }
+    k_spin_unlock(&reassembly_lock, key);
+
+    if (next_deadline != INT64_MAX) {
+        k_work_reschedule(&reassembly_timeout_work, K_MSEC(next_deadline - now));
+    }
+}
+
+int asdc_frag_send(const struct device *dev, uint8_t peer, const struct asdc_packet *packet, size_t mtu,
+                   struct asdc_frag_state *state)
+{
+    const uint8_t version = asdc_tx_wire_version(peer);
+    struct asdc_wire_packet frag = asdc_wire_packet_of(packet);
+    frag.flags |= ASDC_PACKET_FLAG_FRAGMENT;
+
+    // without a length the size of a compact header does not depend on the chunk
+    const size_t header_len = asdc_wire_header_size(&frag, version, false);
+    const size_t overhead = header_len + sizeof(struct asdc_frag_header);
+    if (mtu <= overhead) {
+        return -EMSGSIZE;
+    }
+
+    const size_t chunk_max = mtu - overhead;
+    if (state->offset == 0) {
+        state->msg_id = next_msg_id++;
+    }
+
+    while (state->offset < packet->len) {
+        size_t chunk = MIN(chunk_max, packet->len - state->offset);
+
+        // build each fragment straight in a transport buffer
+        struct net_buf *buf = asdc_transport_alloc_buf(dev, overhead + chunk, K_NO_WAIT);
+        if (!buf) {
+            return -ENOBUFS;
+        }
+
+        frag.len = sizeof(struct asdc_frag_header) + chunk;
+        asdc_wire_put_header(net_buf_add(buf, header_len), &frag, version, false);
+
+        struct asdc_frag_header *hdr = net_buf_add(buf, sizeof(struct asdc_frag_header));
+        hdr->msg_id = sys_cpu_to_le16(state->msg_id);
+        hdr->offset = sys_cpu_to_le16(state->offset);
+        hdr->total_len = sys_cpu_to_le16(packet->len);
+
+        net_buf_add_mem(buf, packet->data + state->offset, chunk);
+        int err = asdc_transport_send_buf(dev, peer, buf);
+        if (err == -ENOBUFS) {
+            net_buf_unref(buf);
+        }
+        if (err < 0) {
+            return err;
+        }
+        state->offset += chunk;
+    }
+
+    return 0;
+}
+
+uint8_t *asdc_frag_reassemble(uint8_t peer, const struct asdc_wire_packet *packet, size_t *len)
+{
+    if (packet->len <= sizeof(struct asdc_frag_header)) {
+        LOG_ERR("Received asdc fragment without payload");
+        return NULL;
+    }
+
+    const struct asdc_frag_header *hdr = (const struct asdc_frag_header *)packet->data;
+    const uint16_t msg_id = sys_le16_to_cpu(hdr->msg_id);
+    const uint16_t offset = sys_le16_to_cpu(hdr->offset);
+    const uint16_t total_len = sys_le16_to_cpu(hdr->total_len);
+    const size_t chunk = packet->len - sizeof(struct asdc_frag_header);
+
+    if (total_len > CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_MAX_MESSAGE_SIZE ||
+        offset + chunk > total_len) {
+        LOG_ERR("Received asdc fragment out of bounds (offset %u, len %zu, total %u)",
+                offset, chunk, total_len);
+        return NULL;
+    }
+
+    uint8_t *complete = NULL;
+    bool schedule_timeout = false;
+
+    k_spinlock_key_t key = k_spin_lock(&reassembly_lock);
+
+    struct asdc_reassembly_slot *slot = NULL;
+    struct asdc_reassembly_slot *free_slot = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(reassembly_slots); i++) {
+        struct asdc_reassembly_slot *s = &reassembly_slots[i];
+        if (!s->data) {
+            free_slot = free_slot ? free_slot : s;
+            continue;
+        }
+        // a sender only has one message in flight per channel, a new one supersedes it
+        if (s->peer == peer && s->channel_id == packet->channel_id) {
+            slot = s;
+            break;
+        }
+    }
+
+    if (slot && (slot->msg_id != msg_id || slot->received != offset)) {
+        LOG_WRN("asdc reassembly of message %u on channel %u abandoned", slot->msg_id, slot->channel_id);
+        reassembly_slot_free(slot);
+        free_slot = slot;
+        slot = NULL;
+    }
+
+    if (!slot) {
+        // fragments arrive in order over the transport, anything else is a leftover
+        if (offset != 0) {
+            goto unlock;
+        }
+        if (!free_slot) {
+            LOG_ERR("No free asdc reassembly slot for channel %u", packet->channel_id);
+            goto unlock;
+        }
+        free_slot->data = asdc_pool_alloc(total_len);
+        if (!free_slot->data) {
+            LOG_ERR("Failed to allocate pool block for asdc reassembly");
+            goto unlock;
+        }
+        slot = free_slot;
+        slot->peer = peer;
+        slot->channel_id = packet->channel_id;
+        slot->msg_id = msg_id;
+        slot->total_len = total_len;
+        slot->received = 0;
+        slot->deadline = k_uptime_get() + CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_REASSEMBLY_TIMEOUT_MS;
+        schedule_timeout = true;
+    }
+
+    memcpy(slot->data + offset, hdr + 1, chunk);
+    slot->received += chunk;
+
+    if (slot->received == slot->total_len) {
+        complete = slot->data;
+        *len = slot->total_len;
+        slot->data = NULL;
+    }
+
+unlock:
+    k_spin_unlock(&reassembly_lock, key);
+
+    if (schedule_timeout) {
+        k_work_schedule(&reassembly_timeout_work,
+                        K_MSEC(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_REASSEMBLY_TIMEOUT_MS));
+    }
+
+    return complete;
+}
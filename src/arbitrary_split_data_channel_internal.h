@@ -0,0 +1,305 @@
+#ifndef ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_INTERNAL_H_
+#define ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_INTERNAL_H_
+
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/buf.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_wire.h"
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TRACING)
+#include <zephyr/tracing/tracing.h>
+// named event for the tracing backend, compiled out unless tracing of this module is enabled
+#define ASDC_TRACE(name, arg0, arg1) sys_trace_named_event("asdc_" name, (arg0), (arg1))
+#else
+#define ASDC_TRACE(name, arg0, arg1) do { } while (0)
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_STATS)
+#define ASDC_STAT_ADD(dev, counter, n)                                          \
+    atomic_add(&((struct asdc_data *)(dev)->data)->counters.counter, (n))
+#else
+#define ASDC_STAT_ADD(dev, counter, n) do { } while (0)
+#endif
+
+#define ASDC_STAT_INC(dev, counter) ASDC_STAT_ADD(dev, counter, 1)
+
+// dedicated workqueue running the tx work, transports may use it for their own deferred sending
+extern struct k_work_q asdc_work_q;
+
+//
+// Transport-specific functions, implemented in src/(type of transport)
+//
+
+int asdc_transport_init(const struct device *dev);
+
+// Sending never blocks. -ENOBUFS means the transport is out of buffers, the data was not consumed
+// and should be sent again after the transport called asdc_on_tx_ready().
+// peer is a peer index or ASDC_PEER_BROADCAST.
+int asdc_transport_send_data(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len);
+
+// largest sdu that can currently be sent to peer, or to every connected peer, dev may be NULL
+size_t asdc_transport_get_mtu(const struct device *dev, uint8_t peer);
+
+// allocates a transport buffer with room for len bytes after the transport headroom
+struct net_buf *asdc_transport_alloc_buf(const struct device *dev, size_t len, k_timeout_t timeout);
+// Sends a buffer from asdc_transport_alloc_buf(), which must hold the only reference to it. buf
+// is consumed unless -ENOBUFS is returned, the caller then still owns it unchanged and may send it
+// again after asdc_on_tx_ready().
+int asdc_transport_send_buf(const struct device *dev, uint8_t peer, struct net_buf *buf);
+
+// gives back a buffer taken by asdc_on_data_received_buf() in zero-copy rx mode
+void asdc_transport_rx_release(void *rx_ctx, struct net_buf *buf);
+
+// Number of L2CAP channels of a split link. The traffic of a channel, its control messages
+// included, always uses the one given by its l2cap-channel property, so each has its own order.
+// Transports with a single link to each peer ignore it.
+#define ASDC_L2CAP_CHANNELS CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_L2CAP_CHANNELS
+
+// index of the l2cap channel carrying the traffic of dev, dev may be NULL
+static inline uint8_t asdc_l2cap_channel(const struct device *dev)
+{
+    return dev ? ((const struct asdc_config *)dev->config)->l2cap_channel : 0;
+}
+
+//
+// Load of the channels, sampled by the BLE link manager
+//
+
+// messages waiting in the tx queues of every channel, control messages included
+uint32_t asdc_tx_queued(void);
+// bytes handed to the transport since boot, wraps around
+uint32_t asdc_tx_bytes_sent(void);
+
+struct bt_conn;
+// Connection to peer with a reference taken, NULL if there is none. Implemented by the BLE
+// transports.
+struct bt_conn *asdc_ble_peer_conn(uint8_t peer);
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_MANAGER)
+// Restarts the sampling, which stops while no peer is connected or the link is idle. Called for
+// every message queued, cheap while the sampling runs.
+void asdc_link_wake(void);
+#else
+static inline void asdc_link_wake(void) {}
+#endif
+
+//
+// Control messages, sent as packets flagged with ASDC_PACKET_FLAG_CONTROL on the channel they
+// concern. The first byte of the data is the type.
+//
+
+enum asdc_ctrl_type {
+    ASDC_CTRL_CREDIT = 1,           // the receiver consumed messages up to seq
+    ASDC_CTRL_ACK = 2,              // the receiver of a reliable channel got messages up to seq
+    ASDC_CTRL_SYNC = 3,             // state of a reliable channel, sent on connect
+    ASDC_CTRL_RESYNC = 4,           // the receiver of a delta channel needs a full snapshot
+    ASDC_CTRL_HELLO = 5,            // header formats the sender reads, sent on connect
+};
+
+struct asdc_ctrl_credit {
+    uint8_t type;
+    uint8_t seq;
+} __packed;
+
+struct asdc_ctrl_ack {
+    uint8_t type;
+    uint8_t seq;
+    uint32_t sack;                  // bit n is set if seq + 2 + n was received out of order
+} __packed;
+
+// the receiver has not received anything on the channel since it started
+#define ASDC_CTRL_SYNC_FLAG_FRESH BIT(0)
+
+struct asdc_ctrl_sync {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t expected;               // next sequence number the receiver passes on
+    uint8_t first;                  // oldest sequence number the sender still has
+} __packed;
+
+struct asdc_ctrl_resync {
+    uint8_t type;
+} __packed;
+
+struct asdc_ctrl_hello {
+    uint8_t type;
+    uint8_t wire_version;           // highest ASDC_WIRE_VERSION_* the sender reads
+} __packed;
+
+// queues a control message for peer, ahead of all channel traffic
+int asdc_queue_control(const struct device *dev, uint8_t peer, const void *msg, size_t len);
+// queues a copy of data on the channel of dev for peer, without waiting for room
+int asdc_queue_message(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len);
+// queues a copy of a packet sent before for peer, ahead of all channel traffic
+int asdc_queue_retransmit(const struct device *dev, uint8_t peer, const struct asdc_packet *packet);
+
+// queues a pool block holding a received payload for the recv callback, takes ownership of data
+// unless it fails
+int asdc_rx_queue(const struct device *dev, uint8_t peer, uint8_t seq, uint8_t *data, size_t len);
+
+// wakes senders waiting for room on the channel of dev and schedules its tx-ready callback
+void asdc_tx_space_freed(const struct device *dev);
+
+bool asdc_peer_is_connected(uint8_t peer);
+
+//
+// Credit based flow control, see the tx-credits devicetree property
+//
+
+// stamps the next sequence number towards peer into packet, false if the credit window is full
+bool asdc_credit_take(const struct device *dev, uint8_t peer, struct asdc_packet *packet);
+// gives back the credit of a message that could not be queued after all
+void asdc_credit_untake(const struct device *dev, uint8_t peer);
+// the message with seq from peer was passed to the recv callback or dropped
+void asdc_credit_consumed(const struct device *dev, uint8_t peer, uint8_t seq);
+// the peer reported it consumed our messages up to seq
+void asdc_credit_received(const struct device *dev, uint8_t peer, uint8_t seq);
+// starts over the credit windows of every channel towards a peer that (re)connected
+void asdc_credit_reset(uint8_t peer);
+// continues the sequence numbers towards peer after seq, with nothing in flight
+void asdc_credit_resync(const struct device *dev, uint8_t peer, uint8_t seq);
+
+//
+// Messages replayed on reconnect, see the retain-count devicetree property
+//
+
+struct asdc_retained_msg {
+    uint8_t *data;                  // pool block holding the payload
+    uint16_t len;
+    uint8_t peer;                   // peer it was sent to, or ASDC_PEER_BROADCAST
+};
+
+// keeps a copy of a message sent to peer, replacing an older one with the same key
+void asdc_retain(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len);
+// sends the messages retained so far to a peer that connected
+void asdc_retain_replay(uint8_t peer);
+
+//
+// Delta encoding, see the delta mode of the devicetree binding
+//
+
+// the payload is a whole snapshot instead of the ranges that changed
+#define ASDC_DELTA_FLAG_FULL BIT(0)
+
+// starts the payload of every message of a delta channel
+struct asdc_delta_header {
+    uint8_t flags;
+    uint8_t base;                   // generation of the snapshot the delta applies to
+    uint8_t gen;                    // generation of the snapshot it results in
+} __packed;
+
+// Stores data as the channel's snapshot and returns the length of the message to send instead,
+// in a pool block stored in msg.
+int asdc_delta_encode(const struct device *dev, const uint8_t *data, size_t len, uint8_t **msg);
+// the last message encoded could not be queued for peer, which needs a full snapshot now
+void asdc_delta_unsent(const struct device *dev, uint8_t peer);
+// Applies a received message to the snapshot of peer and returns a pool block with the result
+// in state. -ESTALE if it does not apply to the snapshot, a full one is requested then.
+int asdc_delta_decode(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len,
+                      uint8_t **state, size_t *state_len);
+// forgets the snapshot of peer, which could not be passed on, and requests a full one
+void asdc_delta_resync(const struct device *dev, uint8_t peer);
+void asdc_delta_resync_received(const struct device *dev, uint8_t peer);
+void asdc_delta_connected(uint8_t peer);
+
+//
+// Reliable delivery, see the reliable devicetree property
+//
+
+// false until the peer told us its receive state after connecting
+bool asdc_reliable_tx_synced(const struct device *dev, uint8_t peer);
+// keeps a packet that was handed to the transport until the peer acknowledges it, takes ownership
+void asdc_reliable_sent(const struct device *dev, uint8_t peer, uint8_t *packet);
+// passes a received payload on in order, takes ownership of data
+void asdc_reliable_received(const struct device *dev, uint8_t peer, uint8_t seq, uint8_t *data, size_t len);
+void asdc_reliable_ack_received(const struct device *dev, uint8_t peer, const struct asdc_ctrl_ack *msg);
+void asdc_reliable_sync_received(const struct device *dev, uint8_t peer, const struct asdc_ctrl_sync *msg);
+void asdc_reliable_connected(uint8_t peer);
+void asdc_reliable_disconnected(uint8_t peer);
+
+//
+// Fixed-block packet pool used by the tx and rx queues
+//
+
+struct asdc_pool_class {
+    struct k_mem_slab *slab;
+    size_t block_size;
+    uint32_t num_blocks;
+    atomic_t num_used;
+    atomic_t max_used;
+    atomic_t alloc_failures;
+};
+
+// every block starts with a pointer back to its size class so that freeing is O(1)
+struct asdc_pool_block {
+    struct asdc_pool_class *cls;
+    uint8_t data[];
+};
+
+#define ASDC_POOL_SLAB_BLOCK_SIZE(size) WB_UP(sizeof(struct asdc_pool_block) + (size))
+
+// Defines a size class that is not part of the shared pool, for the packets of a channel with
+// the max-payload-size property. Its blocks are freed with asdc_pool_free() like any other.
+#define ASDC_POOL_CLASS_DEFINE(name, size, count)                               \
+    K_MEM_SLAB_DEFINE_STATIC(name##_slab, ASDC_POOL_SLAB_BLOCK_SIZE(size),      \
+                             count, sizeof(void *));                            \
+    static struct asdc_pool_class name = {                                      \
+        .slab = &name##_slab,                                                   \
+        .block_size = (size),                                                   \
+        .num_blocks = (count),                                                  \
+    };
+
+// returns NULL if no block of at least size bytes is free
+void *asdc_pool_alloc(size_t size);
+// like asdc_pool_alloc, but only takes a block of the given class
+void *asdc_pool_class_alloc(struct asdc_pool_class *cls, size_t size);
+void asdc_pool_free(void *block);
+
+// largest allocation the pool can ever satisfy
+size_t asdc_pool_max_alloc_size(void);
+
+//
+// Fragmentation of packets larger than the transport MTU
+//
+
+// size of the header in front of the data of each fragment
+#define ASDC_FRAG_HEADER_SIZE 6
+
+// how far a packet sent as fragments got, zero before its first fragment
+struct asdc_frag_state {
+    uint16_t msg_id;
+    uint16_t offset;                // of the next fragment to send
+};
+
+// Sends packet as a series of fragments that each fit in mtu, carrying on from state. Returns
+// -ENOBUFS if the transport ran out of buffers, state then holds where to resume once it has some
+// again, so the receiver gets the rest of the message instead of a partial one.
+int asdc_frag_send(const struct device *dev, uint8_t peer, const struct asdc_packet *packet, size_t mtu,
+                   struct asdc_frag_state *state);
+
+// Adds a received fragment to its reassembly buffer. Once the message is complete it returns
+// the pool block holding it and stores its length in len, otherwise NULL.
+uint8_t *asdc_frag_reassemble(uint8_t peer, const struct asdc_wire_packet *packet, size_t *len);
+
+//
+// Packet headers on the wire, see arbitrary_split_data_channel_wire.h
+//
+
+// header format sent to peer, for ASDC_PEER_BROADCAST one every connected peer reads
+uint8_t asdc_tx_wire_version(uint8_t peer);
+
+// header fields of a packet queued for sending
+static inline struct asdc_wire_packet asdc_wire_packet_of(const struct asdc_packet *packet)
+{
+    return (struct asdc_wire_packet){
+        .channel_id = packet->channel_id,
+        .flags = packet->flags,
+        .seq = packet->seq,
+        .len = packet->len,
+        .data = (uint8_t *)packet->data,
+    };
+}
+
+#endif // ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_INTERNAL_H_
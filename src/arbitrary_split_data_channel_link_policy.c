@@ -0,0 +1,31 @@
+#include "arbitrary_split_data_channel_link_policy.h"
+
+bool asdc_link_policy_update(const struct asdc_link_policy *policy,
+                             struct asdc_link_policy_state *state, uint32_t queued,
+                             uint32_t bytes_per_sec, uint32_t elapsed_ms)
+{
+    bool busy = queued >= policy->bulk_queue_depth || bytes_per_sec >= policy->bulk_bytes_per_sec;
+
+    if (busy) {
+        // switch up at once, a transfer should not wait for the sample after next
+        state->quiet_ms = 0;
+        if (!state->bulk) {
+            state->bulk = true;
+            return true;
+        }
+        return false;
+    }
+
+    if (!state->bulk) {
+        return false;
+    }
+
+    // only relax after a while, so the gaps between the bursts of a transfer do not flap the link
+    state->quiet_ms += elapsed_ms;
+    if (state->quiet_ms < policy->idle_hold_ms) {
+        return false;
+    }
+    state->bulk = false;
+    state->quiet_ms = 0;
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_POLICY_H_
+#define ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_POLICY_H_
+
+// Decides when the split link should switch between its bulk and idle connection parameters.
+// Only depends on the C library so that tests/link_policy can test it on its own, the BLE link
+// manager samples the channel load and applies the result.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// connection parameters requested for one profile, in the units of the Bluetooth spec
+struct asdc_link_params {
+    uint16_t interval_min;          // 1.25 ms units
+    uint16_t interval_max;          // 1.25 ms units
+    uint16_t latency;               // connection events the peripheral may skip
+    uint16_t timeout;               // supervision timeout in 10 ms units
+    bool phy_2m;                    // 2M PHY instead of 1M
+    bool max_data_len;              // largest link layer packets instead of the default
+};
+
+struct asdc_link_policy {
+    uint32_t bulk_queue_depth;      // queued messages that switch to the bulk profile, at least 1
+    uint32_t bulk_bytes_per_sec;    // tx rate that switches to the bulk profile, at least 1
+    uint32_t idle_hold_ms;          // time below both before switching back to the idle profile
+    struct asdc_link_params bulk;
+    struct asdc_link_params idle;
+};
+
+struct asdc_link_policy_state {
+    bool bulk;                      // the bulk profile is in use
+    uint32_t quiet_ms;              // time spent below both thresholds in the bulk profile
+};
+
+// Feeds one sample of the load, taken elapsed_ms after the previous one. Returns true if the
+// profile changed, the parameters to request are then given by asdc_link_policy_params().
+bool asdc_link_policy_update(const struct asdc_link_policy *policy,
+                             struct asdc_link_policy_state *state, uint32_t queued,
+                             uint32_t bytes_per_sec, uint32_t elapsed_ms);
+
+static inline const struct asdc_link_params *
+asdc_link_policy_params(const struct asdc_link_policy *policy,
+                        const struct asdc_link_policy_state *state)
+{
+    return state->bulk ? &policy->bulk : &policy->idle;
+}
+
+#endif // ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_POLICY_H_
@@ -0,0 +1,164 @@
+
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/atomic.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+BUILD_ASSERT(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_SMALL_BLOCK_SIZE <
+             CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_LARGE_BLOCK_SIZE,
+             "asdc pool small blocks must be smaller than large blocks");
+
+K_MEM_SLAB_DEFINE_STATIC(asdc_pool_small_slab,
+                         ASDC_POOL_SLAB_BLOCK_SIZE(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_SMALL_BLOCK_SIZE),
+                         CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_SMALL_BLOCK_COUNT,
+                         sizeof(void *));
+K_MEM_SLAB_DEFINE_STATIC(asdc_pool_large_slab,
+                         ASDC_POOL_SLAB_BLOCK_SIZE(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_LARGE_BLOCK_SIZE),
+                         CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_LARGE_BLOCK_COUNT,
+                         sizeof(void *));
+
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION)
+#define ASDC_POOL_MESSAGE_BLOCK_SIZE \
+    (sizeof(struct asdc_packet) + CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_MAX_MESSAGE_SIZE)
+
+BUILD_ASSERT(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_LARGE_BLOCK_SIZE < ASDC_POOL_MESSAGE_BLOCK_SIZE,
+             "asdc max message size must be larger than the large pool blocks");
+
+// holds whole messages before fragmenting and after reassembly
+K_MEM_SLAB_DEFINE_STATIC(asdc_pool_message_slab,
+                         ASDC_POOL_SLAB_BLOCK_SIZE(ASDC_POOL_MESSAGE_BLOCK_SIZE),
+                         CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_MESSAGE_BLOCK_COUNT,
+                         sizeof(void *));
+#endif
+
+// ordered from smallest to largest block size
+static struct asdc_pool_class asdc_pool_classes[] = {
+    {
+        .slab = &asdc_pool_small_slab,
+        .block_size = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_SMALL_BLOCK_SIZE,
+        .num_blocks = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_SMALL_BLOCK_COUNT,
+    },
+    {
+        .slab = &asdc_pool_large_slab,
+        .block_size = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_LARGE_BLOCK_SIZE,
+        .num_blocks = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_LARGE_BLOCK_COUNT,
+    },
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION)
+    {
+        .slab = &asdc_pool_message_slab,
+        .block_size = ASDC_POOL_MESSAGE_BLOCK_SIZE,
+        .num_blocks = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_POOL_MESSAGE_BLOCK_COUNT,
+    },
+#endif
+};
+
+static void asdc_pool_track_used(struct asdc_pool_class *cls)
+{
+    atomic_val_t used = atomic_inc(&cls->num_used) + 1;
+    atomic_val_t max = atomic_get(&cls->max_used);
+    while (used > max && !atomic_cas(&cls->max_used, max, used)) {
+        max = atomic_get(&cls->max_used);
+    }
+}
+
+static void *asdc_pool_try_alloc(struct asdc_pool_class *cls)
+{
+    struct asdc_pool_block *block;
+    if (k_mem_slab_alloc(cls->slab, (void **)&block, K_NO_WAIT) < 0) {
+        return NULL;
+    }
+    block->cls = cls;
+    asdc_pool_track_used(cls);
+    return block->data;
+}
+
+void *asdc_pool_alloc(size_t size)
+{
+    struct asdc_pool_class *first_fit = NULL;
+
+    // fall through to the next larger class if the best fitting one is exhausted
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_pool_classes); i++) {
+        struct asdc_pool_class *cls = &asdc_pool_classes[i];
+        if (size > cls->block_size) {
+            continue;
+        }
+        if (!first_fit) {
+            first_fit = cls;
+        }
+
+        void *data = asdc_pool_try_alloc(cls);
+        if (data) {
+            return data;
+        }
+    }
+
+    if (first_fit) {
+        atomic_inc(&first_fit->alloc_failures);
+    }
+    return NULL;
+}
+
+void *asdc_pool_class_alloc(struct asdc_pool_class *cls, size_t size)
+{
+    void *data = size <= cls->block_size ? asdc_pool_try_alloc(cls) : NULL;
+    if (!data) {
+        atomic_inc(&cls->alloc_failures);
+    }
+    return data;
+}
+
+void asdc_pool_free(void *data)
+{
+    if (!data) {
+        return;
+    }
+
+    struct asdc_pool_block *block = CONTAINER_OF(data, struct asdc_pool_block, data);
+    struct asdc_pool_class *cls = block->cls;
+    atomic_dec(&cls->num_used);
+    k_mem_slab_free(cls->slab, (void *)block);
+}
+
+size_t asdc_pool_max_alloc_size(void)
+{
+    return asdc_pool_classes[ARRAY_SIZE(asdc_pool_classes) - 1].block_size;
+}
+
+static void asdc_pool_class_stats(struct asdc_pool_class *cls, struct asdc_pool_stats *stats)
+{
+    stats->block_size = cls->block_size;
+    stats->num_blocks = cls->num_blocks;
+    stats->num_used = atomic_get(&cls->num_used);
+    stats->max_used = atomic_get(&cls->max_used);
+    stats->alloc_failures = atomic_get(&cls->alloc_failures);
+}
+
+int asdc_pool_get_stats(size_t size_class, struct asdc_pool_stats *stats)
+{
+    if (size_class >= ARRAY_SIZE(asdc_pool_classes)) {
+        return -ENOENT;
+    }
+
+    asdc_pool_class_stats(&asdc_pool_classes[size_class], stats);
+    return 0;
+}
+
+int asdc_pool_get_channel_stats(const struct device *dev, struct asdc_pool_stats *stats)
+{
+    struct asdc_pool_class *cls = ((const struct asdc_config *)dev->config)->pool;
+    if (!cls) {
+        return -ENOENT;
+    }
+
+    asdc_pool_class_stats(cls, stats);
+    return 0;
+}
@@ -0,0 +1,424 @@
+#define DT_DRV_COMPAT zmk_arbitrary_split_data_channel
+
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/device.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Reliable channels pass every message to the recv callback exactly once and in order, across
+// reconnects too. Messages carry the sequence numbers of the credit window and the sender keeps
+// each one until the receiver acknowledged it. Acks are cumulative and carry a bitmap of the
+// messages received out of order, so only the missing ones are sent again: a message is lost
+// once one sent after it arrived, or when it was not acknowledged within the retransmit timeout.
+// The receiver holds messages that arrive after a gap until it is filled and drops duplicates.
+//
+// After connecting, both sides send a sync message with the state of their receive side. The
+// sender drops what the receiver already has and sends the rest again, a receiver that lost its
+// state starts at the oldest message the sender still has.
+
+#define ASDC_RELIABLE_ACK_DELAY_MS 5
+#define ASDC_RELIABLE_RETRY_MS 10
+#define ASDC_RELIABLE_RTO_MS CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RETRANSMIT_TIMEOUT_MS
+
+// sequence numbers wrap at 256, which the window has to divide for the slots to stay unique
+BUILD_ASSERT(IS_POWER_OF_TWO(ASDC_RELIABLE_WINDOW),
+             "CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RELIABLE_MAX_WINDOW must be a power of two");
+
+#define ASDC_RELIABLE_SLOT(seq) ((uint8_t)(seq) % ASDC_RELIABLE_WINDOW)
+
+#define ASDC_RELIABLE_CHANNEL_DEV(n) DEVICE_DT_INST_GET(n),
+static const struct device *const asdc_reliable_channels[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_RELIABLE_CHANNEL_DEV)
+};
+
+static struct k_spinlock asdc_reliable_lock;
+
+static void asdc_reliable_ack_work_callback(struct k_work *work);
+static void asdc_reliable_rtx_work_callback(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(asdc_reliable_ack_work, asdc_reliable_ack_work_callback);
+static K_WORK_DELAYABLE_DEFINE(asdc_reliable_rtx_work, asdc_reliable_rtx_work_callback);
+
+// a broadcast on a single-peer build goes to peer 0, other broadcasts are split up by the sender
+static struct asdc_reliable_state *asdc_reliable_state(const struct device *dev, uint8_t peer)
+{
+    if (!((const struct asdc_config *)dev->config)->reliable) {
+        return NULL;
+    }
+    if (peer == ASDC_PEER_BROADCAST && ASDC_MAX_PEERS == 1) {
+        peer = 0;
+    }
+    if (peer >= ASDC_MAX_PEERS) {
+        return NULL;
+    }
+    return &((struct asdc_data *)dev->data)->reliable[peer];
+}
+
+static bool asdc_reliable_sacked(const struct asdc_reliable_state *st, uint8_t seq)
+{
+    uint8_t n = seq - st->tx_acked - 2;
+    return n < 32 && (st->tx_sacked & BIT(n));
+}
+
+// Drops the sent packets up to seq, which the peer received. Returns false if seq is not one
+// of the packets in flight.
+static bool asdc_reliable_tx_acked(struct asdc_reliable_state *st, uint8_t seq)
+{
+    if ((uint8_t)(seq - st->tx_acked) > (uint8_t)(st->tx_sent - st->tx_acked)) {
+        return false;
+    }
+
+    while (st->tx_acked != seq) {
+        uint8_t slot = ASDC_RELIABLE_SLOT(++st->tx_acked);
+        if (st->tx_packets[slot]) {
+            asdc_pool_free(st->tx_packets[slot]);
+            st->tx_packets[slot] = NULL;
+        }
+    }
+    return true;
+}
+
+static void asdc_reliable_drop_held(struct asdc_reliable_state *st)
+{
+    for (size_t i = 0; i < ASDC_RELIABLE_WINDOW; i++) {
+        if (st->rx_held[i]) {
+            asdc_pool_free(st->rx_held[i]);
+            st->rx_held[i] = NULL;
+        }
+    }
+}
+
+bool asdc_reliable_tx_synced(const struct device *dev, uint8_t peer)
+{
+    struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+    return st && st->tx_synced;
+}
+
+void asdc_reliable_sent(const struct device *dev, uint8_t peer, uint8_t *packet)
+{
+    struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+    if (!st) {
+        asdc_pool_free(packet);
+        return;
+    }
+
+    uint8_t seq = ((const struct asdc_packet *)packet)->seq;
+    uint8_t slot = ASDC_RELIABLE_SLOT(seq);
+    k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+
+    // only packets numbered before the peer made us start over can be outside the window
+    uint8_t ahead = seq - st->tx_acked;
+    if (ahead == 0 || ahead > ASDC_RELIABLE_WINDOW || st->tx_packets[slot]) {
+        k_spin_unlock(&asdc_reliable_lock, key);
+        LOG_WRN("Dropping asdc message %u of device %s numbered before a resync", seq, dev->name);
+        asdc_pool_free(packet);
+        return;
+    }
+
+    st->tx_packets[slot] = packet;
+    st->tx_sent_at[slot] = k_uptime_get_32();
+    st->tx_order[slot] = ++st->tx_count;
+    if (ahead > (uint8_t)(st->tx_sent - st->tx_acked)) {
+        st->tx_sent = seq;
+    }
+
+    k_spin_unlock(&asdc_reliable_lock, key);
+
+    k_work_schedule_for_queue(&asdc_work_q, &asdc_reliable_rtx_work, K_MSEC(ASDC_RELIABLE_RTO_MS));
+}
+
+void asdc_reliable_received(const struct device *dev, uint8_t peer, uint8_t seq, uint8_t *data, size_t len)
+{
+    struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+    if (!st) {
+        asdc_pool_free(data);
+        return;
+    }
+
+    uint8_t window = ((const struct asdc_config *)dev->config)->tx_credits;
+    k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+
+    // until the peer's sync message we do not know where its messages start, it sends them again
+    if (!st->rx_synced) {
+        k_spin_unlock(&asdc_reliable_lock, key);
+        asdc_pool_free(data);
+        return;
+    }
+
+    uint8_t ahead = seq - st->rx_expected;
+    uint8_t slot = ASDC_RELIABLE_SLOT(seq);
+
+    if (ahead >= window || (ahead > 0 && st->rx_held[slot])) {
+        // passed on already, our ack must have been lost
+        ASDC_STAT_INC(dev, rx_duplicates);
+        asdc_pool_free(data);
+    } else if (ahead > 0) {
+        st->rx_held[slot] = data;
+        st->rx_held_len[slot] = len;
+    } else if (asdc_rx_queue(dev, peer, seq, data, len) < 0) {
+        // not acknowledged, the sender tries again
+        ASDC_STAT_INC(dev, rx_dropped);
+        asdc_pool_free(data);
+    } else {
+        st->rx_expected++;
+
+        // pass on what was held back by the gap that just closed
+        while ((data = st->rx_held[ASDC_RELIABLE_SLOT(st->rx_expected)])) {
+            slot = ASDC_RELIABLE_SLOT(st->rx_expected);
+            st->rx_held[slot] = NULL;
+            if (asdc_rx_queue(dev, peer, st->rx_expected, data, st->rx_held_len[slot]) < 0) {
+                // the rx queue is full, give up the rest. None of it was acknowledged in order,
+                // so the sender sends it again after the retransmit timeout.
+                ASDC_STAT_INC(dev, rx_dropped);
+                asdc_pool_free(data);
+                asdc_reliable_drop_held(st);
+                break;
+            }
+            st->rx_expected++;
+        }
+    }
+
+    st->ack_pending = true;
+    k_spin_unlock(&asdc_reliable_lock, key);
+
+    // acks of messages received close together are combined
+    k_work_schedule_for_queue(&asdc_work_q, &asdc_reliable_ack_work, K_MSEC(ASDC_RELIABLE_ACK_DELAY_MS));
+}
+
+void asdc_reliable_ack_received(const struct device *dev, uint8_t peer, const struct asdc_ctrl_ack *msg)
+{
+    struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+    if (!st) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+
+    if (!asdc_reliable_tx_acked(st, msg->seq)) {
+        k_spin_unlock(&asdc_reliable_lock, key);
+        return;
+    }
+    st->tx_sacked = msg->sack;
+
+    // the link delivers in order, so a gap before the latest packet the peer holds was lost
+    bool any_sacked = false;
+    uint16_t newest = 0;
+    for (uint8_t seq = st->tx_acked + 2; seq != (uint8_t)(st->tx_sent + 1); seq++) {
+        uint16_t order = st->tx_order[ASDC_RELIABLE_SLOT(seq)];
+        if (asdc_reliable_sacked(st, seq) && (!any_sacked || (int16_t)(order - newest) > 0)) {
+            newest = order;
+            any_sacked = true;
+        }
+    }
+
+    for (uint8_t seq = st->tx_acked + 1; any_sacked && seq != (uint8_t)(st->tx_sent + 1); seq++) {
+        uint8_t slot = ASDC_RELIABLE_SLOT(seq);
+        if (!st->tx_packets[slot] || asdc_reliable_sacked(st, seq) ||
+            (int16_t)(newest - st->tx_order[slot]) <= 0) {
+            continue;
+        }
+        if (asdc_queue_retransmit(dev, peer, (const struct asdc_packet *)st->tx_packets[slot]) < 0) {
+            // left to the retransmit timeout
+            break;
+        }
+        st->tx_sent_at[slot] = k_uptime_get_32();
+        st->tx_order[slot] = ++st->tx_count;
+    }
+
+    k_spin_unlock(&asdc_reliable_lock, key);
+
+    asdc_credit_received(dev, peer, msg->seq);
+}
+
+void asdc_reliable_sync_received(const struct device *dev, uint8_t peer, const struct asdc_ctrl_sync *msg)
+{
+    struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+    if (!st) {
+        return;
+    }
+
+    bool resync = false;
+    k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+
+    // our receive side, a fresh one starts at the oldest message the peer still has. If we are
+    // behind that, the peer gave up on the messages in between.
+    uint8_t behind = msg->first - st->rx_expected;
+    if (!st->rx_synced || (behind > 0 && behind < 128)) {
+        asdc_reliable_drop_held(st);
+        st->rx_expected = msg->first;
+        st->rx_synced = true;
+    }
+
+    // our send side
+    if (!(msg->flags & ASDC_CTRL_SYNC_FLAG_FRESH) && !asdc_reliable_tx_acked(st, msg->expected - 1)) {
+        // we lost our state, or the peer expects messages we never sent. Continue where it is.
+        for (size_t i = 0; i < ASDC_RELIABLE_WINDOW; i++) {
+            if (st->tx_packets[i]) {
+                LOG_WRN("Dropping unacknowledged asdc messages of device %s on resync", dev->name);
+                asdc_pool_free(st->tx_packets[i]);
+                st->tx_packets[i] = NULL;
+            }
+        }
+        st->tx_acked = msg->expected - 1;
+        st->tx_sent = st->tx_acked;
+        resync = true;
+    }
+
+    // everything not acknowledged goes out again
+    st->tx_sacked = 0;
+    for (size_t i = 0; i < ASDC_RELIABLE_WINDOW; i++) {
+        st->tx_sent_at[i] = k_uptime_get_32() - ASDC_RELIABLE_RTO_MS;
+    }
+    st->tx_synced = true;
+    uint8_t acked = st->tx_acked;
+
+    k_spin_unlock(&asdc_reliable_lock, key);
+
+    if (resync) {
+        asdc_credit_resync(dev, peer, acked);
+    } else {
+        asdc_credit_received(dev, peer, acked);
+    }
+    k_work_reschedule_for_queue(&asdc_work_q, &asdc_reliable_rtx_work, K_NO_WAIT);
+}
+
+void asdc_reliable_connected(uint8_t peer)
+{
+    k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_reliable_channels); i++) {
+        struct asdc_reliable_state *st = asdc_reliable_state(asdc_reliable_channels[i], peer);
+        if (st) {
+            st->tx_synced = false;
+            st->sync_pending = true;
+        }
+    }
+    k_spin_unlock(&asdc_reliable_lock, key);
+
+    k_work_reschedule_for_queue(&asdc_work_q, &asdc_reliable_ack_work, K_NO_WAIT);
+}
+
+void asdc_reliable_disconnected(uint8_t peer)
+{
+    k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_reliable_channels); i++) {
+        struct asdc_reliable_state *st = asdc_reliable_state(asdc_reliable_channels[i], peer);
+        if (st) {
+            // sent packets are kept for the next connection
+            st->tx_synced = false;
+            st->sync_pending = false;
+        }
+    }
+    k_spin_unlock(&asdc_reliable_lock, key);
+}
+
+// sends the pending sync message and ack of every reliable channel
+static void asdc_reliable_ack_work_callback(struct k_work *work)
+{
+    bool retry = false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_reliable_channels); i++) {
+        const struct device *dev = asdc_reliable_channels[i];
+
+        for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+            struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+            if (!st || !asdc_peer_is_connected(peer)) {
+                continue;
+            }
+
+            k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+            bool sync = st->sync_pending;
+            bool ack = st->ack_pending && st->rx_synced;
+            st->sync_pending = false;
+            st->ack_pending = false;
+
+            struct asdc_ctrl_sync sync_msg = {
+                .type = ASDC_CTRL_SYNC,
+                .flags = st->rx_synced ? 0 : ASDC_CTRL_SYNC_FLAG_FRESH,
+                .expected = st->rx_expected,
+                .first = st->tx_acked + 1,
+            };
+            struct asdc_ctrl_ack ack_msg = {
+                .type = ASDC_CTRL_ACK,
+                .seq = st->rx_expected - 1,
+            };
+            for (uint8_t n = 0; n + 1 < ASDC_RELIABLE_WINDOW; n++) {
+                if (st->rx_held[ASDC_RELIABLE_SLOT(st->rx_expected + 1 + n)]) {
+                    ack_msg.sack |= BIT(n);
+                }
+            }
+            k_spin_unlock(&asdc_reliable_lock, key);
+
+            bool sync_failed = sync && asdc_queue_control(dev, peer, &sync_msg, sizeof(sync_msg)) < 0;
+            bool ack_failed = ack && asdc_queue_control(dev, peer, &ack_msg, sizeof(ack_msg)) < 0;
+            if (sync_failed || ack_failed) {
+                key = k_spin_lock(&asdc_reliable_lock);
+                st->sync_pending |= sync_failed;
+                st->ack_pending |= ack_failed;
+                k_spin_unlock(&asdc_reliable_lock, key);
+                retry = true;
+            }
+        }
+    }
+
+    if (retry) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_reliable_ack_work, K_MSEC(ASDC_RELIABLE_RETRY_MS));
+    }
+}
+
+// sends again the packets that were not acknowledged within the retransmit timeout
+static void asdc_reliable_rtx_work_callback(struct k_work *work)
+{
+    uint32_t now = k_uptime_get_32();
+    int32_t next = -1;
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_reliable_channels); i++) {
+        const struct device *dev = asdc_reliable_channels[i];
+
+        for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+            struct asdc_reliable_state *st = asdc_reliable_state(dev, peer);
+            // the packets of a disconnected peer go out after its next sync message
+            if (!st || !st->tx_synced || !asdc_peer_is_connected(peer)) {
+                continue;
+            }
+
+            k_spinlock_key_t key = k_spin_lock(&asdc_reliable_lock);
+            for (uint8_t seq = st->tx_acked + 1; seq != (uint8_t)(st->tx_sent + 1); seq++) {
+                uint8_t slot = ASDC_RELIABLE_SLOT(seq);
+                if (!st->tx_packets[slot] || asdc_reliable_sacked(st, seq)) {
+                    continue;
+                }
+
+                int32_t age = now - st->tx_sent_at[slot];
+                if (age >= ASDC_RELIABLE_RTO_MS) {
+                    const struct asdc_packet *packet = (const struct asdc_packet *)st->tx_packets[slot];
+                    if (asdc_queue_retransmit(dev, peer, packet) < 0) {
+                        next = ASDC_RELIABLE_RETRY_MS;
+                        break;
+                    }
+                    st->tx_sent_at[slot] = now;
+                    st->tx_order[slot] = ++st->tx_count;
+                    age = 0;
+                }
+
+                int32_t due = ASDC_RELIABLE_RTO_MS - age;
+                if (next < 0 || due < next) {
+                    next = due;
+                }
+            }
+            k_spin_unlock(&asdc_reliable_lock, key);
+        }
+    }
+
+    if (next >= 0) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_reliable_rtx_work, K_MSEC(next));
+    }
+}
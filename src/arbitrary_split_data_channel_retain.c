@@ -0,0 +1,159 @@
+#define DT_DRV_COMPAT zmk_arbitrary_split_data_channel
+
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/device.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Channels with the retain-count property keep a copy of the last messages sent, oldest first,
+// and send them again to every peer that (re)connects. With retain-key-size, a message replaces
+// the retained one that starts with the same key, so each key costs one message on reconnect.
+
+#define ASDC_RETAIN_RETRY_MS 10
+
+#define ASDC_RETAIN_CHANNEL_DEV(n) DEVICE_DT_INST_GET(n),
+static const struct device *const asdc_retain_channels[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_RETAIN_CHANNEL_DEV)
+};
+
+static struct k_spinlock asdc_retain_lock;
+
+static void asdc_retain_work_callback(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(asdc_retain_work, asdc_retain_work_callback);
+
+// removes the retained message at index i, keeping the replay positions on the same messages
+static uint8_t *asdc_retain_remove(const struct device *dev, size_t i)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_retain_state *rs = &((struct asdc_data *)dev->data)->retain;
+    uint8_t *data = cfg->retained[i].data;
+
+    memmove(&cfg->retained[i], &cfg->retained[i + 1], (rs->used - i - 1) * sizeof(cfg->retained[0]));
+    rs->used--;
+
+    for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+        if (rs->replay_next[peer] > i) {
+            rs->replay_next[peer]--;
+        }
+        if (rs->replay_end[peer] > i) {
+            rs->replay_end[peer]--;
+        }
+    }
+    return data;
+}
+
+void asdc_retain(const struct device *dev, uint8_t peer, const uint8_t *data, size_t len)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_retain_state *rs = &((struct asdc_data *)dev->data)->retain;
+
+    if (cfg->retain_count == 0) {
+        return;
+    }
+
+    uint8_t *copy = asdc_pool_alloc(len);
+    if (!copy) {
+        LOG_WRN("No pool block to retain asdc message of device %s", dev->name);
+        return;
+    }
+    memcpy(copy, data, len);
+
+    uint8_t *stale = NULL;
+    k_spinlock_key_t key = k_spin_lock(&asdc_retain_lock);
+
+    if (cfg->retain_key_size > 0 && len >= cfg->retain_key_size) {
+        for (size_t i = 0; i < rs->used; i++) {
+            const struct asdc_retained_msg *msg = &cfg->retained[i];
+            if (msg->peer == peer && msg->len >= cfg->retain_key_size &&
+                memcmp(msg->data, data, cfg->retain_key_size) == 0) {
+                stale = asdc_retain_remove(dev, i);
+                break;
+            }
+        }
+    }
+
+    if (!stale && rs->used == cfg->retain_count) {
+        stale = asdc_retain_remove(dev, 0);
+    }
+
+    cfg->retained[rs->used++] = (struct asdc_retained_msg){
+        .data = copy,
+        .len = len,
+        .peer = peer,
+    };
+
+    k_spin_unlock(&asdc_retain_lock, key);
+
+    if (stale) {
+        asdc_pool_free(stale);
+    }
+}
+
+void asdc_retain_replay(uint8_t peer)
+{
+    bool any = false;
+    k_spinlock_key_t key = k_spin_lock(&asdc_retain_lock);
+
+    // only what was retained up to now, messages sent from here on reach the peer anyway
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_retain_channels); i++) {
+        struct asdc_retain_state *rs = &((struct asdc_data *)asdc_retain_channels[i]->data)->retain;
+        rs->replay_next[peer] = 0;
+        rs->replay_end[peer] = rs->used;
+        any |= rs->used > 0;
+    }
+
+    k_spin_unlock(&asdc_retain_lock, key);
+
+    if (any) {
+        k_work_reschedule_for_queue(&asdc_work_q, &asdc_retain_work, K_NO_WAIT);
+    }
+}
+
+static void asdc_retain_work_callback(struct k_work *work)
+{
+    bool retry = false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_retain_channels); i++) {
+        const struct device *dev = asdc_retain_channels[i];
+        const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+        struct asdc_retain_state *rs = &((struct asdc_data *)dev->data)->retain;
+
+        for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+            k_spinlock_key_t key = k_spin_lock(&asdc_retain_lock);
+
+            while (rs->replay_next[peer] < rs->replay_end[peer]) {
+                if (!asdc_peer_is_connected(peer)) {
+                    rs->replay_next[peer] = rs->replay_end[peer];
+                    break;
+                }
+
+                const struct asdc_retained_msg *msg = &cfg->retained[rs->replay_next[peer]];
+                if (msg->peer == ASDC_PEER_BROADCAST || msg->peer == peer) {
+                    if (asdc_queue_message(dev, peer, msg->data, msg->len) < 0) {
+                        // the channel's queue is full, the rest follows once it drained a bit
+                        retry = true;
+                        break;
+                    }
+                }
+                rs->replay_next[peer]++;
+            }
+
+            k_spin_unlock(&asdc_retain_lock, key);
+        }
+    }
+
+    if (retry) {
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_retain_work, K_MSEC(ASDC_RETAIN_RETRY_MS));
+    }
+}
@@ -0,0 +1,94 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arbitrary_split_data_channel_schema.h>
+
+// a uint64_t takes at most 10 groups of 7 bits
+#define ASDC_VARINT_MAX_LEN 10
+
+bool asdc_schema_put_uint(uint8_t **pos, const uint8_t *end, uint64_t v)
+{
+    uint8_t *p = *pos;
+
+    do {
+        if (p >= end) {
+            return false;
+        }
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        *p++ = byte | (v ? 0x80 : 0);
+    } while (v);
+
+    *pos = p;
+    return true;
+}
+
+bool asdc_schema_get_uint(const uint8_t **pos, const uint8_t *end, uint64_t *v)
+{
+    const uint8_t *p = *pos;
+    uint64_t value = 0;
+
+    for (int i = 0; i < ASDC_VARINT_MAX_LEN; i++) {
+        if (p >= end) {
+            return false;
+        }
+        uint8_t byte = *p++;
+        // the tenth group only has room for the top bit
+        if (i == ASDC_VARINT_MAX_LEN - 1 && byte > 1) {
+            return false;
+        }
+        value |= (uint64_t)(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80)) {
+            *pos = p;
+            *v = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// zigzag maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ... so small magnitudes give short varints
+bool asdc_schema_put_int(uint8_t **pos, const uint8_t *end, int64_t v)
+{
+    return asdc_schema_put_uint(pos, end, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+bool asdc_schema_get_int(const uint8_t **pos, const uint8_t *end, int64_t *v)
+{
+    uint64_t u;
+    if (!asdc_schema_get_uint(pos, end, &u)) {
+        return false;
+    }
+    *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return true;
+}
+
+bool asdc_schema_put_bytes(uint8_t **pos, const uint8_t *end, const struct asdc_schema_bytes *v)
+{
+    uint8_t *p = *pos;
+
+    if (!asdc_schema_put_uint(&p, end, v->len) || (size_t)(end - p) < v->len) {
+        return false;
+    }
+    if (v->len) {
+        memcpy(p, v->data, v->len);
+    }
+    *pos = p + v->len;
+    return true;
+}
+
+bool asdc_schema_get_bytes(const uint8_t **pos, const uint8_t *end, struct asdc_schema_bytes *v)
+{
+    const uint8_t *p = *pos;
+    uint64_t len;
+
+    if (!asdc_schema_get_uint(&p, end, &len) || (uint64_t)(end - p) < len) {
+        return false;
+    }
+    v->data = p;
+    v->len = (size_t)len;
+    *pos = p + len;
+    return true;
+}
@@ -0,0 +1,142 @@
+#define DT_DRV_COMPAT zmk_arbitrary_split_data_channel
+
+#include <zephyr/devicetree.h>
+#include <zephyr/device.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+#include <string.h>
+
+#include <arbitrary_split_data_channel.h>
+
+#define ASDC_SHELL_CHANNEL_DEV(n) DEVICE_DT_INST_GET(n),
+static const struct device *const asdc_shell_channels[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ASDC_SHELL_CHANNEL_DEV)
+};
+
+// the channel named by argv[1], NULL and an error message if there is none
+static const struct device *asdc_shell_channel(const struct shell *sh, const char *name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_shell_channels); i++) {
+        if (strcmp(asdc_shell_channels[i]->name, name) == 0) {
+            return asdc_shell_channels[i];
+        }
+    }
+    shell_error(sh, "No asdc channel named %s", name);
+    return NULL;
+}
+
+static void asdc_shell_print_stats(const struct shell *sh, const struct device *dev)
+{
+    const struct asdc_config *cfg = (const struct asdc_config *)dev->config;
+    struct asdc_stats stats;
+
+    if (asdc_get_stats(dev, &stats) < 0) {
+        return;
+    }
+
+    shell_print(sh, "%s (channel %d)", dev->name, cfg->channel_id);
+    shell_print(sh, "  tx: %u messages, %u bytes, max queue depth %u", stats.tx_messages,
+                stats.tx_bytes, stats.tx_max_queue_depth);
+    shell_print(sh, "      %u queue full, %u too large, %u alloc failures", stats.tx_dropped,
+                stats.tx_mtu_rejects, stats.tx_alloc_failures);
+    shell_print(sh, "  rx: %u messages, %u bytes, %u dropped, %u alloc failures",
+                stats.rx_messages, stats.rx_bytes, stats.rx_dropped, stats.rx_alloc_failures);
+    if (cfg->reliable) {
+        shell_print(sh, "  %u retransmitted, %u duplicates received", stats.tx_retransmits,
+                    stats.rx_duplicates);
+    }
+
+    shell_print(sh, "  tx latency:");
+    for (size_t i = 0; i < ASDC_STATS_LATENCY_BUCKETS; i++) {
+        if (stats.tx_latency[i] == 0) {
+            continue;
+        }
+        if (i == ASDC_STATS_LATENCY_BUCKETS - 1) {
+            shell_print(sh, "    >= %8u us: %u", (uint32_t)BIT(i - 1), stats.tx_latency[i]);
+        } else {
+            shell_print(sh, "    <  %8u us: %u", (uint32_t)BIT(i), stats.tx_latency[i]);
+        }
+    }
+}
+
+static int cmd_asdc_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    if (argc > 1) {
+        const struct device *dev = asdc_shell_channel(sh, argv[1]);
+        if (!dev) {
+            return -ENODEV;
+        }
+        asdc_shell_print_stats(sh, dev);
+        return 0;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_shell_channels); i++) {
+        asdc_shell_print_stats(sh, asdc_shell_channels[i]);
+    }
+    return 0;
+}
+
+static int cmd_asdc_reset(const struct shell *sh, size_t argc, char **argv)
+{
+    if (argc > 1) {
+        const struct device *dev = asdc_shell_channel(sh, argv[1]);
+        if (!dev) {
+            return -ENODEV;
+        }
+        asdc_reset_stats(dev);
+        return 0;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_shell_channels); i++) {
+        asdc_reset_stats(asdc_shell_channels[i]);
+    }
+    return 0;
+}
+
+static int cmd_asdc_pool(const struct shell *sh, size_t argc, char **argv)
+{
+    struct asdc_pool_stats stats;
+
+    for (size_t i = 0; asdc_pool_get_stats(i, &stats) == 0; i++) {
+        shell_print(sh, "%4zu byte blocks: %u/%u used, max %u, %u alloc failures",
+                    stats.block_size, stats.num_used, stats.num_blocks, stats.max_used,
+                    stats.alloc_failures);
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(asdc_shell_channels); i++) {
+        const struct device *dev = asdc_shell_channels[i];
+        if (asdc_pool_get_channel_stats(dev, &stats) == 0) {
+            shell_print(sh, "%4zu byte blocks of %s: %u/%u used, max %u, %u alloc failures",
+                        stats.block_size, dev->name, stats.num_used, stats.num_blocks,
+                        stats.max_used, stats.alloc_failures);
+        }
+    }
+    return 0;
+}
+
+static int cmd_asdc_link(const struct shell *sh, size_t argc, char **argv)
+{
+    struct asdc_link_stats stats;
+
+    int err = asdc_link_get_stats(&stats);
+    if (err < 0) {
+        shell_error(sh, "Link manager not enabled");
+        return err;
+    }
+
+    shell_print(sh, "%s parameters, %u queued, %u B/s", stats.bulk ? "bulk" : "idle",
+                stats.queued, stats.bytes_per_sec);
+    shell_print(sh, "  switches: %u to bulk, %u to idle", stats.bulk_switches, stats.idle_switches);
+    shell_print(sh, "  requests: %u, %u failed", stats.update_requests, stats.update_failures);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(asdc_cmds,
+    SHELL_CMD_ARG(stats, NULL, "Show channel statistics [channel]", cmd_asdc_stats, 1, 1),
+    SHELL_CMD_ARG(reset, NULL, "Reset channel statistics [channel]", cmd_asdc_reset, 1, 1),
+    SHELL_CMD(pool, NULL, "Show packet pool usage", cmd_asdc_pool),
+    SHELL_CMD(link, NULL, "Show the state of the link manager", cmd_asdc_link),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(asdc, &asdc_cmds, "Arbitrary split data channel commands", NULL);
@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arbitrary_split_data_channel_schema.h>
+#include "arbitrary_split_data_channel_wire.h"
+
+static size_t asdc_wire_varint_size(uint32_t v)
+{
+    size_t size = 1;
+    while (v >>= 7) {
+        size++;
+    }
+    return size;
+}
+
+size_t asdc_wire_header_size(const struct asdc_wire_packet *packet, uint8_t version, bool with_len)
+{
+    if (version == ASDC_WIRE_VERSION_LEGACY) {
+        return ASDC_WIRE_LEGACY_HEADER_SIZE;
+    }
+
+    return 1 + asdc_wire_varint_size(packet->channel_id) + (packet->seq ? 1 : 0) +
+           (with_len ? asdc_wire_varint_size(packet->len) : 0);
+}
+
+size_t asdc_wire_put_header(uint8_t *buf, const struct asdc_wire_packet *packet, uint8_t version,
+                            bool with_len)
+{
+    if (version == ASDC_WIRE_VERSION_LEGACY) {
+        buf[0] = packet->channel_id & 0xff;
+        buf[1] = packet->channel_id >> 8;
+        buf[2] = packet->flags;
+        buf[3] = packet->seq;
+        buf[4] = packet->len & 0xff;
+        buf[5] = (packet->len >> 8) & 0xff;
+        buf[6] = (packet->len >> 16) & 0xff;
+        buf[7] = packet->len >> 24;
+        return ASDC_WIRE_LEGACY_HEADER_SIZE;
+    }
+
+    // the caller made room for all of it, end only bounds the varints
+    uint8_t *pos = buf + 1;
+    const uint8_t *end = buf + ASDC_WIRE_COMPACT_MAX_HEADER_SIZE;
+
+    buf[0] = ASDC_WIRE_COMPACT | (packet->flags & ASDC_WIRE_PACKET_FLAGS);
+    asdc_schema_put_uint(&pos, end, packet->channel_id);
+    if (packet->seq) {
+        buf[0] |= ASDC_WIRE_HAS_SEQ;
+        *pos++ = packet->seq;
+    }
+    if (with_len) {
+        buf[0] |= ASDC_WIRE_HAS_LEN;
+        asdc_schema_put_uint(&pos, end, packet->len);
+    }
+    return pos - buf;
+}
+
+static int asdc_wire_parse_legacy(const uint8_t *data, size_t len, struct asdc_wire_packet *packet)
+{
+    if (len < ASDC_WIRE_LEGACY_HEADER_SIZE) {
+        return -EBADMSG;
+    }
+
+    packet->channel_id = data[0] | (data[1] << 8);
+    packet->flags = data[2];
+    packet->seq = data[3];
+    packet->len = (uint32_t)data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16) |
+                  ((uint32_t)data[7] << 24);
+    return ASDC_WIRE_LEGACY_HEADER_SIZE;
+}
+
+static int asdc_wire_parse_compact(const uint8_t *data, size_t len, struct asdc_wire_packet *packet)
+{
+    const uint8_t *pos = data + 1;
+    const uint8_t *end = data + len;
+    uint64_t v;
+
+    if (data[0] & ASDC_WIRE_RESERVED) {
+        return -EPROTONOSUPPORT;
+    }
+    packet->flags = data[0] & ASDC_WIRE_PACKET_FLAGS;
+
+    if (!asdc_schema_get_uint(&pos, end, &v) || v > UINT16_MAX) {
+        return -EBADMSG;
+    }
+    packet->channel_id = v;
+
+    packet->seq = 0;
+    if (data[0] & ASDC_WIRE_HAS_SEQ) {
+        if (pos >= end) {
+            return -EBADMSG;
+        }
+        packet->seq = *pos++;
+    }
+
+    if (data[0] & ASDC_WIRE_HAS_LEN) {
+        if (!asdc_schema_get_uint(&pos, end, &v) || v > UINT32_MAX) {
+            return -EBADMSG;
+        }
+        packet->len = v;
+    } else {
+        packet->len = end - pos;
+    }
+
+    return pos - data;
+}
+
+int asdc_wire_parse(uint8_t *data, size_t len, bool compact, struct asdc_wire_packet *packet)
+{
+    if (len == 0) {
+        return -EBADMSG;
+    }
+
+    int header_len = compact && (data[0] & ASDC_WIRE_COMPACT)
+                         ? asdc_wire_parse_compact(data, len, packet)
+                         : asdc_wire_parse_legacy(data, len, packet);
+    if (header_len < 0) {
+        return header_len;
+    }
+
+    if (packet->len > len - header_len) {
+        return -EMSGSIZE;
+    }
+    if (packet->len == 0) {
+        return -ENODATA;
+    }
+
+    packet->data = data + header_len;
+    return header_len;
+}
@@ -0,0 +1,62 @@
+#ifndef ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRE_H_
+#define ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRE_H_
+
+// Header formats of the packets in an sdu. Only depends on the schema varints, which need the
+// toolchain and util headers of Zephyr but nothing else of it, so that the parser, which sees
+// whatever the peer sends, is tested on its own by tests/wire.
+//
+// The legacy header is struct asdc_packet as laid out on a little-endian target: the channel id
+// (16 bits), the flags, seq and the payload length (32 bits), 8 bytes in all.
+//
+// A compact header starts with a byte that has ASDC_WIRE_COMPACT set and carries the packet
+// flags, followed by the channel id as a varint, the seq byte if ASDC_WIRE_HAS_SEQ is set and the
+// payload length as a varint if ASDC_WIRE_HAS_LEN is set. Without a length the payload takes the
+// rest of the sdu, so a packet sent on its own on a channel below 128 has a 2 byte header.
+//
+// The first byte of a legacy header is the low byte of the channel id, so receivers tell the
+// formats apart as long as no channel id has bit 7 set.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// versions announced with ASDC_CTRL_HELLO
+#define ASDC_WIRE_VERSION_LEGACY 0
+#define ASDC_WIRE_VERSION_COMPACT 1
+
+#define ASDC_WIRE_LEGACY_HEADER_SIZE 8
+// flags byte, a 16 bit channel id, seq and a 32 bit length
+#define ASDC_WIRE_COMPACT_MAX_HEADER_SIZE (1 + 3 + 1 + 5)
+
+// bits of the first byte of a compact header
+#define ASDC_WIRE_COMPACT 0x80
+#define ASDC_WIRE_RESERVED 0x40         // left for a later version, rejected by this one
+#define ASDC_WIRE_HAS_LEN 0x20
+#define ASDC_WIRE_HAS_SEQ 0x10          // a packet without it has seq 0
+#define ASDC_WIRE_PACKET_FLAGS 0x0f     // the ASDC_PACKET_FLAG_* bits of the packet
+
+// header fields of a packet and where its payload is
+struct asdc_wire_packet {
+    uint16_t channel_id;
+    uint8_t flags;                  // ASDC_PACKET_FLAG_*
+    uint8_t seq;
+    uint32_t len;
+    uint8_t *data;
+};
+
+// Size of the header of packet in the format of the given version. with_len keeps the length in
+// a compact header, for a packet followed by others in the same sdu.
+size_t asdc_wire_header_size(const struct asdc_wire_packet *packet, uint8_t version, bool with_len);
+
+// writes the header of packet to buf and returns its size, as given by asdc_wire_header_size()
+size_t asdc_wire_put_header(uint8_t *buf, const struct asdc_wire_packet *packet, uint8_t version,
+                            bool with_len);
+
+// Decodes the header of the packet at the start of data, the rest of a received sdu, and points
+// packet->data at its payload. Compact headers are only recognized if compact is set. Returns the
+// size of the header, -EBADMSG if it is truncated or malformed, -EMSGSIZE if the payload runs
+// past the end of data, -ENODATA if it is empty and -EPROTONOSUPPORT for a compact header of a
+// later version.
+int asdc_wire_parse(uint8_t *data, size_t len, bool compact, struct asdc_wire_packet *packet);
+
+#endif // ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRE_H_
@@ -5,26 +5,152 @@
 #include <zephyr/device.h>
 
 #include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
 
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
+#define ASDC_SLOT_TX_QUEUE_SIZE CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE
+
+// one of the l2cap channels opened to a peripheral
+struct asdc_slot_chan {
+    struct bt_l2cap_le_chan chan;
+    uint8_t peer;                   // index of the slot it belongs to
+    uint8_t index;                  // index among the l2cap channels of the slot
+    // messages waiting for this peripheral, the buffers are shared by reference between slots
+    struct net_buf *tx_queue[ASDC_SLOT_TX_QUEUE_SIZE];
+    size_t tx_head;
+    size_t tx_count;
+    // set while an sdu is being sent, until the l2cap sent callback
+    atomic_t tx_in_flight;
+};
+
 struct asdc_peripheral_slot {
     struct bt_conn* conn;
-    struct bt_l2cap_le_chan chan;
+    // address of the last peripheral in this slot, so it keeps its peer index across reconnects
+    bt_addr_le_t addr;
+    struct asdc_slot_chan chans[ASDC_L2CAP_CHANNELS];
+    // bit n is set while l2cap channel n is connected, the peer is connected once all are
+    atomic_t chans_connected;
 };
 
 static struct asdc_peripheral_slot peripheral_slots[CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS];
 
-// match the CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE here
-NET_BUF_POOL_FIXED_DEFINE(asdc_central_tx_pool, 
-                          CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE,
-                          BT_L2CAP_SDU_BUF_SIZE(CONFIG_BT_L2CAP_TX_MTU), 8, NULL);
+static void asdc_central_buf_destroy(struct net_buf *buf);
+static void asdc_central_tx_work_callback(struct k_work *work);
+
+K_WORK_DEFINE(asdc_central_tx_work, asdc_central_tx_work_callback);
+
+// Every l2cap channel has buffers of its own, so one that is out of credits cannot tie up the
+// buffers of the others. The first one matches CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE.
+#define ASDC_CENTRAL_TX_POOL_DEFINE(i, _)                                       \
+    NET_BUF_POOL_FIXED_DEFINE(asdc_central_tx_pool_##i,                         \
+                              COND_CODE_0(i, (CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE), \
+                                          (CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_L2CAP_CHANNEL_BUF_COUNT)), \
+                              BT_L2CAP_SDU_BUF_SIZE(CONFIG_BT_L2CAP_TX_MTU), 8, \
+                              asdc_central_buf_destroy);
+
+LISTIFY(ASDC_L2CAP_CHANNELS, ASDC_CENTRAL_TX_POOL_DEFINE, ())
+
+// Fragments are sent one buffer at a time, resuming once the pool has room again, so the pool
+// only has to fit one fragment. Each has to carry some of the message after its headers though.
+BUILD_ASSERT(!IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION) ||
+             CONFIG_BT_L2CAP_TX_MTU > ASDC_WIRE_LEGACY_HEADER_SIZE + ASDC_FRAG_HEADER_SIZE,
+             "CONFIG_BT_L2CAP_TX_MTU leaves no room for fragment data");
+
+#define ASDC_CENTRAL_TX_POOL_REF(i, _) &asdc_central_tx_pool_##i
+
+static struct net_buf_pool *const asdc_central_tx_pools[] = {
+    LISTIFY(ASDC_L2CAP_CHANNELS, ASDC_CENTRAL_TX_POOL_REF, (,))
+};
+
+// per-peripheral copies of shared buffers, an l2cap channel never has more than one in flight
+NET_BUF_POOL_FIXED_DEFINE(asdc_central_copy_pool,
+                          CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS * ASDC_L2CAP_CHANNELS,
+                          BT_L2CAP_SDU_BUF_SIZE(CONFIG_BT_L2CAP_TX_MTU), 8, asdc_central_buf_destroy);
+
+static void asdc_central_buf_destroy(struct net_buf *buf) {
+    net_buf_destroy(buf);
+
+    // a freed buffer may unblock both the per-peripheral queues and the channel tx queues
+    k_work_submit_to_queue(&asdc_work_q, &asdc_central_tx_work);
+    asdc_on_tx_ready();
+}
+
+static struct net_buf *slot_tx_pop(struct asdc_slot_chan *slot) {
+    struct net_buf *buf = slot->tx_queue[slot->tx_head];
+    slot->tx_head = (slot->tx_head + 1) % ASDC_SLOT_TX_QUEUE_SIZE;
+    slot->tx_count--;
+    return buf;
+}
+
+static void slot_tx_flush(struct asdc_slot_chan *slot) {
+    while (slot->tx_count > 0) {
+        net_buf_unref(slot_tx_pop(slot));
+    }
+}
+
+// Sends the queued buffers of every slot, one sdu at a time per l2cap channel. Never blocks, it
+// runs again whenever an sdu was sent or a buffer was freed.
+static void asdc_central_tx_work_callback(struct k_work *work) {
+    bool freed = false;
+
+    for (uint8_t i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS * ASDC_L2CAP_CHANNELS; i++) {
+        struct asdc_slot_chan *slot =
+            &peripheral_slots[i / ASDC_L2CAP_CHANNELS].chans[i % ASDC_L2CAP_CHANNELS];
+
+        if (!slot->chan.chan.conn) {
+            freed |= slot->tx_count > 0;
+            slot_tx_flush(slot);
+            continue;
+        }
+
+        while (slot->tx_count > 0 && !atomic_get(&slot->tx_in_flight)) {
+            struct net_buf *shared = slot->tx_queue[slot->tx_head];
+            struct net_buf *buf = shared;
+
+            // l2cap takes ownership of what it sends, so copy buffers other slots still refer to
+            if (shared->ref > 1) {
+                buf = net_buf_alloc(&asdc_central_copy_pool, K_NO_WAIT);
+                if (!buf) {
+                    break;
+                }
+                net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+                net_buf_add_mem(buf, shared->data, shared->len);
+                net_buf_unref(shared);
+            }
+            slot_tx_pop(slot);
+            freed = true;
+
+            atomic_set(&slot->tx_in_flight, 1);
+            int err = bt_l2cap_chan_send(&slot->chan.chan, buf);
+            if (err < 0) {
+                LOG_ERR("Failed to send L2CAP data (err %d)", err);
+                atomic_set(&slot->tx_in_flight, 0);
+                net_buf_unref(buf);
+            }
+        }
+    }
+
+    // room in a slot queue, a send that got -ENOBUFS can be tried again
+    if (freed) {
+        asdc_on_tx_ready();
+    }
+}
+
+static struct asdc_slot_chan *slot_for_chan(struct bt_l2cap_chan *chan) {
+    return CONTAINER_OF(BT_L2CAP_LE_CHAN(chan), struct asdc_slot_chan, chan);
+}
 
 static int asdc_l2cap_recv(struct bt_l2cap_chan *chan, struct net_buf *buf) {    
     if (buf->len > 0) {
-        asdc_on_data_received(chan->conn, buf->data, buf->len);
+        uint8_t peer = slot_for_chan(chan)->peer;
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_ZERO_COPY)
+        return asdc_on_data_received_buf(peer, chan, buf);
+#else
+        asdc_on_data_received(peer, buf->data, buf->len);
+#endif
     }
     return 0;
 }
@@ -36,8 +162,17 @@ static void asdc_l2cap_connected(struct bt_l2cap_chan *chan) {
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
     
-    LOG_DBG("L2CAP channel connected: %s, TX MTU %d, RX MTU %d", 
-            addr, le_chan->tx.mtu, le_chan->rx.mtu);
+    struct asdc_slot_chan *slot = slot_for_chan(chan);
+    LOG_DBG("L2CAP channel %d connected: %s, TX MTU %d, RX MTU %d", 
+            slot->index, addr, le_chan->tx.mtu, le_chan->rx.mtu);
+
+    atomic_t *connected = &peripheral_slots[slot->peer].chans_connected;
+    atomic_val_t all = BIT_MASK(ASDC_L2CAP_CHANNELS);
+    atomic_val_t was = atomic_or(connected, BIT(slot->index));
+    atomic_val_t now = was | BIT(slot->index);
+    if (was != all && now == all) {
+        asdc_on_peer_connected(slot->peer);
+    }
 }
 
 static void asdc_l2cap_disconnected(struct bt_l2cap_chan *chan) {
@@ -45,19 +180,73 @@ static void asdc_l2cap_disconnected(struct bt_l2cap_chan *chan) {
     
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
-    LOG_DBG("L2CAP channel disconnected: %s", addr);
+    struct asdc_slot_chan *slot = slot_for_chan(chan);
+    LOG_DBG("L2CAP channel %d disconnected: %s", slot->index, addr);
+
+    // no sent callback will come for an sdu in flight, the tx work drops what is still queued
+    atomic_set(&slot->tx_in_flight, 0);
+    k_work_submit_to_queue(&asdc_work_q, &asdc_central_tx_work);
+
+    // the link is down as soon as any of its l2cap channels is
+    atomic_t *connected = &peripheral_slots[slot->peer].chans_connected;
+    if (atomic_and(connected, ~BIT(slot->index)) == BIT_MASK(ASDC_L2CAP_CHANNELS)) {
+        asdc_on_peer_disconnected(slot->peer);
+    }
+}
+
+static void asdc_l2cap_sent(struct bt_l2cap_chan *chan) {
+    atomic_set(&slot_for_chan(chan)->tx_in_flight, 0);
+    k_work_submit_to_queue(&asdc_work_q, &asdc_central_tx_work);
+}
+
+static void asdc_l2cap_status(struct bt_l2cap_chan *chan, atomic_t *status) {
+    if (atomic_test_bit(status, BT_L2CAP_STATUS_OUT)) {
+        k_work_submit_to_queue(&asdc_work_q, &asdc_central_tx_work);
+    }
 }
 
 static struct bt_l2cap_chan_ops asdc_l2cap_ops = {
     .connected = asdc_l2cap_connected,
     .disconnected = asdc_l2cap_disconnected,
     .recv = asdc_l2cap_recv,
+    .sent = asdc_l2cap_sent,
+    .status = asdc_l2cap_status,
 };
 
 //
 // Bluetooth connection callbacks
 //
 
+// Picks the slot for a new connection: the one this peripheral had before, else one that was
+// never used, else any free one. Keeps peer indices stable across reconnects.
+static struct asdc_peripheral_slot *slot_for_conn(struct bt_conn *conn) {
+    const bt_addr_le_t *dst = bt_conn_get_dst(conn);
+    struct asdc_peripheral_slot *unused = NULL;
+    struct asdc_peripheral_slot *free = NULL;
+
+    for (uint8_t i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS; i++) {
+        struct asdc_peripheral_slot *slot = &peripheral_slots[i];
+
+        if (slot->conn == conn) {
+            return slot;
+        }
+        if (slot->conn) {
+            continue;
+        }
+        if (bt_addr_le_eq(&slot->addr, dst)) {
+            return slot;
+        }
+        if (!unused && bt_addr_le_eq(&slot->addr, BT_ADDR_LE_ANY)) {
+            unused = slot;
+        }
+        if (!free) {
+            free = slot;
+        }
+    }
+
+    return unused ? unused : free;
+}
+
 static void on_connected(struct bt_conn *conn, uint8_t err)
 {
     if (err) {
@@ -68,29 +257,25 @@ static void on_connected(struct bt_conn *conn, uint8_t err)
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
     LOG_DBG("asdc connection callback: %s", addr);
 
-    // Store the connection in the peripherals array
-    uint8_t i;
-    for (i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS; i++) {
-        if (peripheral_slots[i].conn == NULL) {
-            peripheral_slots[i].conn = conn;
-            break;
-        }
-        if (peripheral_slots[i].conn == conn) {
-            break;
-        }
-        if (i == CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS - 1) {
-            LOG_WRN("No space to store new asdc peripheral connection");
-            return;
-        }
+    // Store the connection in the peripherals array, the slot index is the peer index
+    struct asdc_peripheral_slot *slot = slot_for_conn(conn);
+    if (!slot) {
+        LOG_WRN("No space to store new asdc peripheral connection");
+        return;
     }
+    slot->conn = conn;
+    bt_addr_le_copy(&slot->addr, bt_conn_get_dst(conn));
     
-    // Connect L2CAP channel
-    struct bt_l2cap_le_chan *le_chan = &peripheral_slots[i].chan;
-    LOG_DBG("Connecting L2CAP channel to PSM 0x%04x", CONFIG_ZMK_BT_ASDC_L2CAP_PSM);
-    int l2cap_err = bt_l2cap_chan_connect(conn, &le_chan->chan, CONFIG_ZMK_BT_ASDC_L2CAP_PSM);
-    if (l2cap_err) {
-        LOG_ERR("Failed to connect L2CAP channel (err %d)", l2cap_err);
-        return;
+    // Connect the L2CAP channels, each to the PSM of its index
+    for (uint8_t i = 0; i < ASDC_L2CAP_CHANNELS; i++) {
+        struct bt_l2cap_le_chan *le_chan = &slot->chans[i].chan;
+        uint16_t psm = CONFIG_ZMK_BT_ASDC_L2CAP_PSM + i;
+        LOG_DBG("Connecting L2CAP channel to PSM 0x%04x", psm);
+        int l2cap_err = bt_l2cap_chan_connect(conn, &le_chan->chan, psm);
+        if (l2cap_err) {
+            LOG_ERR("Failed to connect L2CAP channel (err %d)", l2cap_err);
+            return;
+        }
     }
 }
 
@@ -121,64 +306,158 @@ BT_CONN_CB_DEFINE(conn_callbacks) = {
 int asdc_transport_init(const struct device *dev) {
 
     for (uint8_t i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS; i++) {
-        peripheral_slots[i].chan.chan.ops = &asdc_l2cap_ops;
-        peripheral_slots[i].chan.rx.mtu = CONFIG_BT_L2CAP_TX_MTU;
+        for (uint8_t j = 0; j < ASDC_L2CAP_CHANNELS; j++) {
+            struct asdc_slot_chan *slot = &peripheral_slots[i].chans[j];
+            slot->chan.chan.ops = &asdc_l2cap_ops;
+            slot->chan.rx.mtu = CONFIG_BT_L2CAP_TX_MTU;
+            slot->peer = i;
+            slot->index = j;
+        }
     }
     return 0;
 }
 
-void asdc_transport_send_data(const struct device *dev, const uint8_t *data, size_t length) {  
-    
+size_t asdc_transport_get_mtu(const struct device *dev, uint8_t peer) {
+    size_t mtu = CONFIG_BT_L2CAP_TX_MTU;
+    for (uint8_t i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS; i++) {
+        if (peer != ASDC_PEER_BROADCAST && peer != i) {
+            continue;
+        }
+        for (uint8_t j = 0; j < ASDC_L2CAP_CHANNELS; j++) {
+            struct asdc_slot_chan *slot = &peripheral_slots[i].chans[j];
+            if (dev && j != asdc_l2cap_channel(dev)) {
+                continue;
+            }
+            if (peripheral_slots[i].conn && slot->chan.chan.conn) {
+                mtu = MIN(mtu, slot->chan.tx.mtu);
+            }
+        }
+    }
+    return mtu;
+}
+
+struct bt_conn *asdc_ble_peer_conn(uint8_t peer) {
+    struct bt_conn *conn = peer < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS ? peripheral_slots[peer].conn : NULL;
+    return conn ? bt_conn_ref(conn) : NULL;
+}
+
+struct net_buf *asdc_transport_alloc_buf(const struct device *dev, size_t length, k_timeout_t timeout) {
+
     if (length > CONFIG_BT_L2CAP_TX_MTU) {
         LOG_ERR("Length %zu exceeds configured MTU %d", length, CONFIG_BT_L2CAP_TX_MTU);
-        return;
+        return NULL;
     }
 
-    // send the data for every peripheral connected to the central
-    for (uint8_t i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS; i++) {
-        struct asdc_peripheral_slot *slot = &peripheral_slots[i];
-        
-        if (!slot->conn) {
-            // no peripheral connected in this slot
-            continue;
-        }
+    struct net_buf *buf = net_buf_alloc(asdc_central_tx_pools[asdc_l2cap_channel(dev)], timeout);
+    if (!buf) {
+        LOG_DBG("No free net_buf for L2CAP send");
+        return NULL;
+    }
 
-        if (!slot->chan.chan.conn) {
-            LOG_ERR("No active L2CAP channel for ASDC data send");
-            continue;
-        }
+    net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
 
-        if (length > slot->chan.tx.mtu) {
-            LOG_ERR("Length %zu exceeds negotiated TX MTU %d", length, slot->chan.tx.mtu);
-            return;
-        }
+    if (length > net_buf_tailroom(buf)) {
+        LOG_ERR("Data too large for buffer (%zu > %d)", length, net_buf_tailroom(buf));
+        net_buf_unref(buf);
+        return NULL;
+    }
 
-        // delay in between sending to multiple peripherals
-        // to avoid overwhelming the BLE stack
-        if (i > 0) {
-            k_msleep(100);
-        }
+    return buf;
+}
 
-        struct net_buf *buf = net_buf_alloc(&asdc_central_tx_pool, K_SECONDS(2));
-        if (!buf) {
-            LOG_ERR("Failed to allocate net_buf for L2CAP send");
-            return;
-        }
+// 0 if the slot can send an sdu of length bytes, -ENOTCONN or -EMSGSIZE otherwise
+static int slot_check_send(struct asdc_slot_chan *slot, size_t length) {
+    if (!peripheral_slots[slot->peer].conn || !slot->chan.chan.conn) {
+        // no peripheral connected in this slot, or its l2cap channel is not up yet
+        return -ENOTCONN;
+    }
 
-        net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
-        
-        if (length > net_buf_tailroom(buf)) {
-            LOG_ERR("Data too large for buffer (%zu > %d)", length, net_buf_tailroom(buf));
+    if (length > slot->chan.tx.mtu) {
+        LOG_ERR("Length %zu exceeds negotiated TX MTU %d", length, slot->chan.tx.mtu);
+        return -EMSGSIZE;
+    }
+
+    return 0;
+}
+
+static void slot_tx_push(struct asdc_slot_chan *slot, struct net_buf *buf) {
+    slot->tx_queue[(slot->tx_head + slot->tx_count) % ASDC_SLOT_TX_QUEUE_SIZE] = buf;
+    slot->tx_count++;
+}
+
+int asdc_transport_send_buf(const struct device *dev, uint8_t peer, struct net_buf *buf) {
+    const uint8_t chan = asdc_l2cap_channel(dev);
+
+    if (peer != ASDC_PEER_BROADCAST) {
+        if (peer >= CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS) {
             net_buf_unref(buf);
-            return;
+            return -EINVAL;
         }
-        
-        net_buf_add_mem(buf, data, length);
 
-        int err = bt_l2cap_chan_send(&slot->chan.chan, buf);
+        struct asdc_slot_chan *slot = &peripheral_slots[peer].chans[chan];
+        int err = slot_check_send(slot, buf->len);
         if (err < 0) {
-            LOG_ERR("Failed to send L2CAP data (err %d)", err);
             net_buf_unref(buf);
+            return err;
         }
+        if (slot->tx_count == ASDC_SLOT_TX_QUEUE_SIZE) {
+            // left to the caller, the tx work calls asdc_on_tx_ready() once there is room
+            return -ENOBUFS;
+        }
+
+        slot_tx_push(slot, buf);
+        k_work_submit_to_queue(&asdc_work_q, &asdc_central_tx_work);
+        return 0;
+    }
+
+    // queue a reference to the same buffer for every peripheral connected to the central
+    bool queued = false;
+    bool full = false;
+
+    for (uint8_t i = 0; i < CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS; i++) {
+        struct asdc_slot_chan *slot = &peripheral_slots[i].chans[chan];
+
+        if (slot_check_send(slot, buf->len) < 0) {
+            continue;
+        }
+        if (slot->tx_count == ASDC_SLOT_TX_QUEUE_SIZE) {
+            full = true;
+            continue;
+        }
+        slot_tx_push(slot, net_buf_ref(buf));
+        queued = true;
+    }
+
+    if (!queued && full) {
+        return -ENOBUFS;
+    }
+    if (full) {
+        // the others have it queued already, sending it again would duplicate it for them
+        LOG_WRN("L2CAP tx queue of a peripheral slot is full, it misses a broadcast");
+    }
+
+    net_buf_unref(buf);
+    k_work_submit_to_queue(&asdc_work_q, &asdc_central_tx_work);
+    return 0;
+}
+
+int asdc_transport_send_data(const struct device *dev, uint8_t peer, const uint8_t *data, size_t length) {
+    struct net_buf *buf = asdc_transport_alloc_buf(dev, length, K_NO_WAIT);
+    if (!buf) {
+        return -ENOBUFS;
+    }
+
+    net_buf_add_mem(buf, data, length);
+    int err = asdc_transport_send_buf(dev, peer, buf);
+    if (err == -ENOBUFS) {
+        net_buf_unref(buf);
+    }
+    return err;
+}
+
+void asdc_transport_rx_release(void *rx_ctx, struct net_buf *buf) {
+    // returns the l2cap credits of the sdu, only fails if the channel went away meanwhile
+    if (bt_l2cap_chan_recv_complete((struct bt_l2cap_chan *)rx_ctx, buf) < 0) {
+        net_buf_unref(buf);
     }
 }
@@ -0,0 +1,194 @@
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+#include "arbitrary_split_data_channel_link_policy.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define ASDC_LINK_SAMPLE_MS CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_SAMPLE_MS
+
+static const struct asdc_link_policy asdc_link_policy = {
+    .bulk_queue_depth = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_BULK_QUEUE_DEPTH,
+    .bulk_bytes_per_sec = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_BULK_RATE,
+    .idle_hold_ms = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_IDLE_HOLD_MS,
+    .bulk = {
+        .interval_min = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_BULK_INTERVAL,
+        .interval_max = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_BULK_INTERVAL,
+        .latency = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_BULK_LATENCY,
+        .timeout = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_TIMEOUT,
+        .phy_2m = true,
+        .max_data_len = true,
+    },
+    .idle = {
+        .interval_min = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_IDLE_INTERVAL,
+        .interval_max = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_IDLE_INTERVAL,
+        .latency = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_IDLE_LATENCY,
+        .timeout = CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_TIMEOUT,
+        .phy_2m = IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_LINK_IDLE_PHY_2M),
+        .max_data_len = false,
+    },
+};
+
+// only touched by the sample work, and by asdc_link_wake() while it is stopped
+static struct asdc_link_policy_state asdc_link_state;
+static uint32_t asdc_link_last_bytes;
+
+// bit n is set while the parameters of the current profile still have to be requested from peer n
+static atomic_t asdc_link_dirty;
+
+// set while the sample work is scheduled, see asdc_link_wake()
+static atomic_t asdc_link_sampling;
+
+static struct k_spinlock asdc_link_stats_lock;
+static struct asdc_link_stats asdc_link_stats;
+
+// requests params on conn, returns the number of requests the stack refused
+static uint32_t asdc_link_apply(struct bt_conn *conn, const struct asdc_link_params *params)
+{
+    uint32_t failures = 0;
+
+    struct bt_le_conn_param conn_param = BT_LE_CONN_PARAM_INIT(
+        params->interval_min, params->interval_max, params->latency, params->timeout);
+    int err = bt_conn_le_param_update(conn, &conn_param);
+    if (err < 0 && err != -EALREADY) {
+        LOG_DBG("asdc link: connection parameter update failed (err %d)", err);
+        failures++;
+    }
+
+#if IS_ENABLED(CONFIG_BT_USER_PHY_UPDATE)
+    uint8_t phy = params->phy_2m ? BT_GAP_LE_PHY_2M : BT_GAP_LE_PHY_1M;
+    struct bt_conn_le_phy_param phy_param = {
+        .options = BT_CONN_LE_PHY_OPT_NONE,
+        .pref_tx_phy = phy,
+        .pref_rx_phy = phy,
+    };
+    err = bt_conn_le_phy_update(conn, &phy_param);
+    if (err < 0 && err != -EALREADY) {
+        LOG_DBG("asdc link: PHY update failed (err %d)", err);
+        failures++;
+    }
+#endif
+
+#if IS_ENABLED(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    struct bt_conn_le_data_len_param len_param = {
+        .tx_max_len = params->max_data_len ? BT_GAP_DATA_LEN_MAX : BT_GAP_DATA_LEN_DEFAULT,
+        .tx_max_time = params->max_data_len ? BT_GAP_DATA_TIME_MAX : BT_GAP_DATA_TIME_DEFAULT,
+    };
+    err = bt_conn_le_data_len_update(conn, &len_param);
+    if (err < 0 && err != -EALREADY) {
+        LOG_DBG("asdc link: data length update failed (err %d)", err);
+        failures++;
+    }
+#endif
+
+    return failures;
+}
+
+#define ASDC_LINK_REQUESTS                                                      \
+    (1 + IS_ENABLED(CONFIG_BT_USER_PHY_UPDATE) + IS_ENABLED(CONFIG_BT_USER_DATA_LEN_UPDATE))
+
+static void asdc_link_sample_work_callback(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(asdc_link_sample_work, asdc_link_sample_work_callback);
+
+static void asdc_link_sample_work_callback(struct k_work *work)
+{
+    uint32_t queued = asdc_tx_queued();
+    uint32_t bytes = asdc_tx_bytes_sent();
+    uint32_t rate = (uint32_t)((uint64_t)(bytes - asdc_link_last_bytes) * MSEC_PER_SEC /
+                               ASDC_LINK_SAMPLE_MS);
+    asdc_link_last_bytes = bytes;
+
+    bool changed = asdc_link_policy_update(&asdc_link_policy, &asdc_link_state, queued, rate,
+                                           ASDC_LINK_SAMPLE_MS);
+    if (changed) {
+        LOG_DBG("asdc link: switching to %s parameters (queued %u, %u B/s)",
+                asdc_link_state.bulk ? "bulk" : "idle", queued, rate);
+        atomic_set(&asdc_link_dirty, BIT_MASK(ASDC_MAX_PEERS));
+    }
+
+    const struct asdc_link_params *params = asdc_link_policy_params(&asdc_link_policy, &asdc_link_state);
+    uint32_t requests = 0;
+    uint32_t failures = 0;
+
+    bool connected = false;
+
+    for (uint8_t peer = 0; peer < ASDC_MAX_PEERS; peer++) {
+        // a peer that is not connected gets the parameters once it is
+        struct bt_conn *conn = asdc_ble_peer_conn(peer);
+        if (!conn) {
+            continue;
+        }
+        connected = true;
+        if (atomic_test_and_clear_bit(&asdc_link_dirty, peer)) {
+            requests += ASDC_LINK_REQUESTS;
+            failures += asdc_link_apply(conn, params);
+        }
+        bt_conn_unref(conn);
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&asdc_link_stats_lock);
+    asdc_link_stats.bulk = asdc_link_state.bulk;
+    asdc_link_stats.queued = queued;
+    asdc_link_stats.bytes_per_sec = rate;
+    if (changed && asdc_link_state.bulk) {
+        asdc_link_stats.bulk_switches++;
+    } else if (changed) {
+        asdc_link_stats.idle_switches++;
+    }
+    asdc_link_stats.update_requests += requests;
+    asdc_link_stats.update_failures += failures;
+    k_spin_unlock(&asdc_link_stats_lock, key);
+
+    // Nothing to watch without a peer or while idle, the tx path and new connections wake the
+    // sampling again. A message queued while the flag was still set is caught by the check after
+    // clearing it.
+    if (!connected || (!asdc_link_state.bulk && queued == 0 && rate == 0)) {
+        atomic_clear(&asdc_link_sampling);
+        if (asdc_tx_queued() == 0) {
+            return;
+        }
+        atomic_set(&asdc_link_sampling, 1);
+    }
+
+    k_work_reschedule_for_queue(&asdc_work_q, &asdc_link_sample_work, K_MSEC(ASDC_LINK_SAMPLE_MS));
+}
+
+void asdc_link_wake(void)
+{
+    if (atomic_cas(&asdc_link_sampling, 0, 1)) {
+        // bytes sent while stopped would count towards the first sample
+        asdc_link_last_bytes = asdc_tx_bytes_sent();
+        k_work_schedule_for_queue(&asdc_work_q, &asdc_link_sample_work,
+                                  K_MSEC(ASDC_LINK_SAMPLE_MS));
+    }
+}
+
+int asdc_link_get_stats(struct asdc_link_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&asdc_link_stats_lock);
+    *stats = asdc_link_stats;
+    k_spin_unlock(&asdc_link_stats_lock, key);
+    return 0;
+}
+
+// A new connection starts with the parameters the other side asked for, so the current profile
+// is requested again on the next sample. The transport may only know the connection a little
+// later, the bit stays set until it does and asdc_on_peer_connected() wakes the sampling again.
+static void asdc_link_connected(struct bt_conn *conn, uint8_t err)
+{
+    if (!err) {
+        atomic_set(&asdc_link_dirty, BIT_MASK(ASDC_MAX_PEERS));
+        asdc_link_wake();
+    }
+}
+
+BT_CONN_CB_DEFINE(asdc_link_conn_callbacks) = {
+    .connected = asdc_link_connected,
+};
+
@@ -5,6 +5,7 @@
 #include <zephyr/device.h>
 
 #include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
 #include <zmk/events/split_peripheral_status_changed.h>
 
 #include <zephyr/logging/log.h>
@@ -15,7 +16,8 @@ static void asdc_l2cap_connected(struct bt_l2cap_chan *chan);
 static void asdc_l2cap_disconnected(struct bt_l2cap_chan *chan);
 static int asdc_l2cap_recv(struct bt_l2cap_chan *chan, struct net_buf *buf);
 
-static struct bt_l2cap_server asdc_l2cap_server;
+// one server per l2cap channel, on consecutive PSMs, so each accepted channel is known by its PSM
+static struct bt_l2cap_server asdc_l2cap_servers[ASDC_L2CAP_CHANNELS];
 
 static struct bt_l2cap_chan_ops asdc_l2cap_ops = {
     .connected = asdc_l2cap_connected,
@@ -23,15 +25,38 @@ static struct bt_l2cap_chan_ops asdc_l2cap_ops = {
     .recv = asdc_l2cap_recv,
 };
 
-static struct bt_l2cap_le_chan asdc_l2cap_chan = {
-	.chan.ops = &asdc_l2cap_ops,
-	.rx.mtu = CONFIG_BT_L2CAP_TX_MTU,
-};
+static struct bt_l2cap_le_chan asdc_l2cap_chans[ASDC_L2CAP_CHANNELS];
+
+// bit n is set while l2cap channel n is connected
+static atomic_t asdc_l2cap_connected_mask;
+
+static void asdc_peripheral_buf_destroy(struct net_buf *buf) {
+    net_buf_destroy(buf);
+    asdc_on_tx_ready();
+}
+
+// Every l2cap channel has buffers of its own, so one that is out of credits cannot tie up the
+// buffers of the others. The first one matches CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE.
+#define ASDC_PERIPHERAL_TX_POOL_DEFINE(i, _)                                    \
+    NET_BUF_POOL_FIXED_DEFINE(asdc_peripheral_tx_pool_##i,                      \
+                              COND_CODE_0(i, (CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE), \
+                                          (CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_L2CAP_CHANNEL_BUF_COUNT)), \
+                              BT_L2CAP_SDU_BUF_SIZE(CONFIG_BT_L2CAP_TX_MTU), 8, \
+                              asdc_peripheral_buf_destroy);
 
-// match the CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE here
-NET_BUF_POOL_FIXED_DEFINE(asdc_peripheral_tx_pool, 
-                          CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE, 
-                          BT_L2CAP_SDU_BUF_SIZE(CONFIG_BT_L2CAP_TX_MTU), 8, NULL);
+LISTIFY(ASDC_L2CAP_CHANNELS, ASDC_PERIPHERAL_TX_POOL_DEFINE, ())
+
+// Fragments are sent one buffer at a time, resuming once the pool has room again, so the pool
+// only has to fit one fragment. Each has to carry some of the message after its headers though.
+BUILD_ASSERT(!IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_FRAGMENTATION) ||
+             CONFIG_BT_L2CAP_TX_MTU > ASDC_WIRE_LEGACY_HEADER_SIZE + ASDC_FRAG_HEADER_SIZE,
+             "CONFIG_BT_L2CAP_TX_MTU leaves no room for fragment data");
+
+#define ASDC_PERIPHERAL_TX_POOL_REF(i, _) &asdc_peripheral_tx_pool_##i
+
+static struct net_buf_pool *const asdc_peripheral_tx_pools[] = {
+    LISTIFY(ASDC_L2CAP_CHANNELS, ASDC_PERIPHERAL_TX_POOL_REF, (,))
+};
 
 //
 // L2CAP Channel Callbacks
@@ -39,11 +64,20 @@ NET_BUF_POOL_FIXED_DEFINE(asdc_peripheral_tx_pool,
 
 static int asdc_l2cap_recv(struct bt_l2cap_chan *chan, struct net_buf *buf) {    
     if (buf->len > 0) {
-        asdc_on_data_received(chan->conn, buf->data, buf->len);
+        // the central is the only peer of a peripheral
+#if IS_ENABLED(CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_RX_ZERO_COPY)
+        return asdc_on_data_received_buf(0, chan, buf);
+#else
+        asdc_on_data_received(0, buf->data, buf->len);
+#endif
     }
     return 0;
 }
 
+static uint8_t chan_index(struct bt_l2cap_chan *chan) {
+    return BT_L2CAP_LE_CHAN(chan) - asdc_l2cap_chans;
+}
+
 static void asdc_l2cap_connected(struct bt_l2cap_chan *chan) {
     struct bt_l2cap_le_chan *le_chan = BT_L2CAP_LE_CHAN(chan);
     struct bt_conn *conn = chan->conn;
@@ -51,8 +85,16 @@ static void asdc_l2cap_connected(struct bt_l2cap_chan *chan) {
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
     
-    LOG_DBG("Peripheral L2CAP channel connected: %s, TX MTU %d, RX MTU %d", 
-            addr, le_chan->tx.mtu, le_chan->rx.mtu);
+    LOG_DBG("Peripheral L2CAP channel %d connected: %s, TX MTU %d, RX MTU %d", 
+            chan_index(chan), addr, le_chan->tx.mtu, le_chan->rx.mtu);
+
+    // the central is only connected once all of its l2cap channels are
+    atomic_val_t all = BIT_MASK(ASDC_L2CAP_CHANNELS);
+    atomic_val_t was = atomic_or(&asdc_l2cap_connected_mask, BIT(chan_index(chan)));
+    atomic_val_t now = was | BIT(chan_index(chan));
+    if (was != all && now == all) {
+        asdc_on_peer_connected(0);
+    }
 }
 
 static void asdc_l2cap_disconnected(struct bt_l2cap_chan *chan) {
@@ -60,21 +102,29 @@ static void asdc_l2cap_disconnected(struct bt_l2cap_chan *chan) {
     
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
-    LOG_DBG("Peripheral L2CAP channel disconnected: %s", addr);
+    LOG_DBG("Peripheral L2CAP channel %d disconnected: %s", chan_index(chan), addr);
+
+    // the link is down as soon as any of its l2cap channels is
+    if (atomic_and(&asdc_l2cap_connected_mask, ~BIT(chan_index(chan))) ==
+        BIT_MASK(ASDC_L2CAP_CHANNELS)) {
+        asdc_on_peer_disconnected(0);
+    }
 }
 
 static int asdc_l2cap_accept(struct bt_conn *conn, struct bt_l2cap_server *server,
                               struct bt_l2cap_chan **chan) {
+    struct bt_l2cap_le_chan *le_chan = &asdc_l2cap_chans[server - asdc_l2cap_servers];
+
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
-    LOG_DBG("L2CAP accept from %s", addr);
+    LOG_DBG("L2CAP accept from %s on PSM 0x%04x", addr, server->psm);
 
-    if (asdc_l2cap_chan.chan.conn) {
+    if (le_chan->chan.conn) {
         LOG_WRN("L2CAP channel already active, rejecting new connection");
         return -ENOMEM;
     }
 
-    *chan = &asdc_l2cap_chan.chan;
+    *chan = &le_chan->chan;
     
     return 0;
 }
@@ -121,42 +171,63 @@ ZMK_SUBSCRIPTION(asdc_split_peripheral, zmk_split_peripheral_status_changed);
 //
 
 int asdc_transport_init(const struct device *dev) {
-    // Register L2CAP server
-    asdc_l2cap_server.psm = CONFIG_ZMK_BT_ASDC_L2CAP_PSM;
-    asdc_l2cap_server.accept = asdc_l2cap_accept;
-    asdc_l2cap_server.sec_level = BT_SECURITY_L1;
-
-    int err = bt_l2cap_server_register(&asdc_l2cap_server);
-    if (err) {
-        LOG_ERR("Failed to register L2CAP server (err %d)", err);
-        return err;
+    // called for every channel instance, the servers are registered once
+    if (asdc_l2cap_servers[0].accept) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < ASDC_L2CAP_CHANNELS; i++) {
+        asdc_l2cap_chans[i].chan.ops = &asdc_l2cap_ops;
+        asdc_l2cap_chans[i].rx.mtu = CONFIG_BT_L2CAP_TX_MTU;
+
+        // Register L2CAP server
+        struct bt_l2cap_server *server = &asdc_l2cap_servers[i];
+        server->psm = CONFIG_ZMK_BT_ASDC_L2CAP_PSM + i;
+        server->accept = asdc_l2cap_accept;
+        server->sec_level = BT_SECURITY_L1;
+
+        int err = bt_l2cap_server_register(server);
+        if (err) {
+            LOG_ERR("Failed to register L2CAP server (err %d)", err);
+            server->accept = NULL;
+            return err;
+        }
+
+        LOG_DBG("L2CAP server registered on PSM 0x%04x", server->psm);
     }
-    
-    LOG_DBG("L2CAP server registered on PSM 0x%04x", CONFIG_ZMK_BT_ASDC_L2CAP_PSM);
     return 0;
 }
 
-void asdc_transport_send_data(const struct device *dev, const uint8_t *data, size_t length) {
-    
-    if (!asdc_l2cap_chan.chan.conn) {
-        LOG_ERR("No active L2CAP channel for ASDC data send");
-        return;
+size_t asdc_transport_get_mtu(const struct device *dev, uint8_t peer) {
+    size_t mtu = CONFIG_BT_L2CAP_TX_MTU;
+    for (uint8_t i = 0; i < ASDC_L2CAP_CHANNELS; i++) {
+        if (dev && i != asdc_l2cap_channel(dev)) {
+            continue;
+        }
+        if (asdc_l2cap_chans[i].chan.conn) {
+            mtu = MIN(mtu, asdc_l2cap_chans[i].tx.mtu);
+        }
     }
+    return mtu;
+}
+
+struct bt_conn *asdc_ble_peer_conn(uint8_t peer) {
+    // the channels only exist on the split connection, so any of them tells which one it is
+    struct bt_conn *conn = peer == 0 ? asdc_l2cap_chans[0].chan.conn : NULL;
+    return conn ? bt_conn_ref(conn) : NULL;
+}
+
+struct net_buf *asdc_transport_alloc_buf(const struct device *dev, size_t length, k_timeout_t timeout) {
 
     if (length > CONFIG_BT_L2CAP_TX_MTU) {
         LOG_ERR("Length %zu exceeds configured MTU %d", length, CONFIG_BT_L2CAP_TX_MTU);
-        return;
-    }
-    
-    if (length > asdc_l2cap_chan.tx.mtu) {
-        LOG_ERR("Length %zu exceeds negotiated TX MTU %d", length, asdc_l2cap_chan.tx.mtu);
-        return;
+        return NULL;
     }
 
-    struct net_buf *buf = net_buf_alloc(&asdc_peripheral_tx_pool, K_SECONDS(2));
+    struct net_buf *buf = net_buf_alloc(asdc_peripheral_tx_pools[asdc_l2cap_channel(dev)], timeout);
     if (!buf) {
-        LOG_ERR("Failed to allocate net_buf for L2CAP send");
-        return;
+        LOG_DBG("No free net_buf for L2CAP send");
+        return NULL;
     }
 
     net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
@@ -164,14 +235,68 @@ void asdc_transport_send_data(const struct device *dev, const uint8_t *data, siz
     if (length > net_buf_tailroom(buf)) {
         LOG_ERR("Data too large for buffer (%zu > %d)", length, net_buf_tailroom(buf));
         net_buf_unref(buf);
-        return;
+        return NULL;
     }
-    
-    net_buf_add_mem(buf, data, length);
 
-    int err = bt_l2cap_chan_send(&asdc_l2cap_chan.chan, buf);
+    return buf;
+}
+
+int asdc_transport_send_buf(const struct device *dev, uint8_t peer, struct net_buf *buf) {
+    struct bt_l2cap_le_chan *le_chan = &asdc_l2cap_chans[asdc_l2cap_channel(dev)];
+
+    if (peer != 0 && peer != ASDC_PEER_BROADCAST) {
+        net_buf_unref(buf);
+        return -EINVAL;
+    }
+
+    if (!le_chan->chan.conn) {
+        LOG_ERR("No active L2CAP channel for ASDC data send");
+        net_buf_unref(buf);
+        return -ENOTCONN;
+    }
+
+    if (buf->len > le_chan->tx.mtu) {
+        LOG_ERR("Length %u exceeds negotiated TX MTU %d", buf->len, le_chan->tx.mtu);
+        net_buf_unref(buf);
+        return -EMSGSIZE;
+    }
+
+    int err = bt_l2cap_chan_send(&le_chan->chan, buf);
+    if (err == -ENOBUFS) {
+        // left to the caller for a retry
+        return err;
+    }
     if (err < 0) {
         LOG_ERR("Failed to send L2CAP data (err %d)", err);
         net_buf_unref(buf);
+        return err;
+    }
+    return 0;
+}
+
+int asdc_transport_send_data(const struct device *dev, uint8_t peer, const uint8_t *data, size_t length) {
+    
+    if (!asdc_l2cap_chans[asdc_l2cap_channel(dev)].chan.conn) {
+        LOG_ERR("No active L2CAP channel for ASDC data send");
+        return -ENOTCONN;
+    }
+
+    struct net_buf *buf = asdc_transport_alloc_buf(dev, length, K_NO_WAIT);
+    if (!buf) {
+        return -ENOBUFS;
+    }
+    
+    net_buf_add_mem(buf, data, length);
+    int err = asdc_transport_send_buf(dev, peer, buf);
+    if (err == -ENOBUFS) {
+        net_buf_unref(buf);
+    }
+    return err;
+}
+
+void asdc_transport_rx_release(void *rx_ctx, struct net_buf *buf) {
+    // returns the l2cap credits of the sdu, only fails if the channel went away meanwhile
+    if (bt_l2cap_chan_recv_complete((struct bt_l2cap_chan *)rx_ctx, buf) < 0) {
+        net_buf_unref(buf);
     }
 }
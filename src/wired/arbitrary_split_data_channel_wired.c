@@ -0,0 +1,460 @@
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <string.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Wired transport over a UART of its own, the zmk,asdc-uart chosen node, so that it can run next
+// to ZMK's wired split on another UART. The other half is peer 0 on both sides.
+//
+// Every sdu is sent as one frame: the sdu followed by its CRC-16/CCITT-FALSE, little-endian, COBS
+// encoded so that it contains no zero bytes, and a zero byte that ends the frame. Empty frames
+// are keepalives, the peer counts as connected while frames arrive from it.
+
+BUILD_ASSERT(DT_HAS_CHOSEN(zmk_asdc_uart),
+             "the wired asdc transport needs a zmk,asdc-uart chosen node");
+
+static const struct device *const asdc_wired_uart = DEVICE_DT_GET(DT_CHOSEN(zmk_asdc_uart));
+
+#define ASDC_WIRED_MTU CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRED_MTU
+#define ASDC_WIRED_CRC_SIZE sizeof(uint16_t)
+// COBS adds one byte per 254 bytes, and one more
+#define ASDC_WIRED_COBS_SIZE(len) ((len) + (len) / 254 + 1)
+// largest frame without its delimiter
+#define ASDC_WIRED_FRAME_SIZE ASDC_WIRED_COBS_SIZE(ASDC_WIRED_MTU + ASDC_WIRED_CRC_SIZE)
+
+#define ASDC_WIRED_KEEPALIVE_MS CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRED_KEEPALIVE_MS
+// the peer is gone after this long without a frame
+#define ASDC_WIRED_LINK_TIMEOUT_MS (4 * ASDC_WIRED_KEEPALIVE_MS)
+
+// idle time after which the UART hands over what it received so far
+#define ASDC_WIRED_RX_TIMEOUT_US 100
+
+static void asdc_wired_buf_destroy(struct net_buf *buf) {
+    net_buf_destroy(buf);
+    asdc_on_tx_ready();
+}
+
+// match the CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE here
+NET_BUF_POOL_FIXED_DEFINE(asdc_wired_tx_pool,
+                          CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_TX_QUEUE_SIZE,
+                          ASDC_WIRED_MTU, 8, asdc_wired_buf_destroy);
+
+// sdus waiting to be framed
+static K_FIFO_DEFINE(asdc_wired_tx_fifo);
+
+// Frames handed to the UART alternate between two buffers, the next frame is encoded while the
+// previous one is sent. A buffer is free while its length is 0.
+static uint8_t asdc_wired_tx_frames[2][ASDC_WIRED_FRAME_SIZE + 1];
+static size_t asdc_wired_tx_len[2];
+// buffer the UART is sending, -1 while it is idle
+static int asdc_wired_tx_sending = -1;
+static struct k_spinlock asdc_wired_tx_lock;
+
+// set when a keepalive frame is due
+static atomic_t asdc_wired_keepalive;
+
+// the UART receives into these in turns and hands what it got to the rx work through the ring
+static uint8_t asdc_wired_rx_dma[2][CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRED_DMA_BUF_SIZE];
+static uint8_t asdc_wired_rx_dma_next;
+RING_BUF_DECLARE(asdc_wired_rx_ring, CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRED_RX_BUF_SIZE);
+static struct k_spinlock asdc_wired_rx_lock;
+
+// frame being received, only touched by the rx work
+static uint8_t asdc_wired_rx_frame[ASDC_WIRED_FRAME_SIZE];
+static size_t asdc_wired_rx_len;
+static bool asdc_wired_rx_overflow;
+static int64_t asdc_wired_rx_at;
+static bool asdc_wired_connected;
+
+static void asdc_wired_tx_work_callback(struct k_work *work);
+static void asdc_wired_rx_work_callback(struct k_work *work);
+static void asdc_wired_link_work_callback(struct k_work *work);
+
+K_WORK_DEFINE(asdc_wired_tx_work, asdc_wired_tx_work_callback);
+K_WORK_DEFINE(asdc_wired_rx_work, asdc_wired_rx_work_callback);
+K_WORK_DELAYABLE_DEFINE(asdc_wired_link_work, asdc_wired_link_work_callback);
+
+//
+// Framing
+//
+
+// COBS encoder writing to out, which needs ASDC_WIRED_COBS_SIZE() bytes for what is put into it
+struct asdc_cobs_encoder {
+    uint8_t *out;
+    size_t code;                    // position of the code byte of the current block
+    size_t pos;
+};
+
+static void asdc_cobs_init(struct asdc_cobs_encoder *enc, uint8_t *out) {
+    enc->out = out;
+    enc->code = 0;
+    enc->pos = 1;
+}
+
+static void asdc_cobs_put(struct asdc_cobs_encoder *enc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == 0) {
+            enc->out[enc->code] = enc->pos - enc->code;
+            enc->code = enc->pos++;
+            continue;
+        }
+
+        enc->out[enc->pos++] = data[i];
+        if (enc->pos - enc->code == 0xff) {
+            enc->out[enc->code] = 0xff;
+            enc->code = enc->pos++;
+        }
+    }
+}
+
+// returns the length of the encoded data
+static size_t asdc_cobs_finish(struct asdc_cobs_encoder *enc) {
+    enc->out[enc->code] = enc->pos - enc->code;
+    return enc->pos;
+}
+
+// decodes a frame in place, returns its decoded length or -EINVAL
+static int asdc_cobs_decode(uint8_t *buf, size_t len) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        uint8_t code = buf[in++];
+        if (code == 0 || (size_t)(code - 1) > len - in) {
+            return -EINVAL;
+        }
+
+        memmove(&buf[out], &buf[in], code - 1);
+        in += code - 1;
+        out += code - 1;
+
+        // a full block is not followed by a zero, neither is the last one
+        if (code != 0xff && in < len) {
+            buf[out++] = 0;
+        }
+    }
+
+    return out;
+}
+
+// encodes an sdu, which may be empty, into a frame with delimiter and returns its length
+static size_t asdc_wired_encode(const uint8_t *data, size_t len, uint8_t *frame) {
+    uint8_t crc[ASDC_WIRED_CRC_SIZE];
+    struct asdc_cobs_encoder enc;
+
+    sys_put_le16(crc16_itu_t(0xffff, data, len), crc);
+
+    asdc_cobs_init(&enc, frame);
+    asdc_cobs_put(&enc, data, len);
+    asdc_cobs_put(&enc, crc, sizeof(crc));
+    size_t frame_len = asdc_cobs_finish(&enc);
+    frame[frame_len++] = 0;
+    return frame_len;
+}
+
+//
+// Sending
+//
+
+// starts sending tx buffer i, called with asdc_wired_tx_lock held
+static void asdc_wired_tx_start(int i) {
+    asdc_wired_tx_sending = i;
+
+    int err = uart_tx(asdc_wired_uart, asdc_wired_tx_frames[i], asdc_wired_tx_len[i], SYS_FOREVER_US);
+    if (err < 0) {
+        LOG_ERR("Failed to start wired asdc tx (err %d)", err);
+        asdc_wired_tx_len[i] = 0;
+        asdc_wired_tx_sending = -1;
+    }
+}
+
+// Encodes queued sdus into the free tx buffers and starts the UART if it is idle. Runs again
+// whenever the UART finished a frame.
+static void asdc_wired_tx_work_callback(struct k_work *work) {
+    for (;;) {
+        k_spinlock_key_t key = k_spin_lock(&asdc_wired_tx_lock);
+        int free = asdc_wired_tx_len[0] == 0 ? 0 : asdc_wired_tx_len[1] == 0 ? 1 : -1;
+        k_spin_unlock(&asdc_wired_tx_lock, key);
+
+        if (free < 0) {
+            return;
+        }
+
+        size_t len;
+        struct net_buf *buf = k_fifo_get(&asdc_wired_tx_fifo, K_NO_WAIT);
+        if (buf) {
+            len = asdc_wired_encode(buf->data, buf->len, asdc_wired_tx_frames[free]);
+            net_buf_unref(buf);
+        } else if (atomic_cas(&asdc_wired_keepalive, 1, 0)) {
+            len = asdc_wired_encode(NULL, 0, asdc_wired_tx_frames[free]);
+        } else {
+            return;
+        }
+
+        key = k_spin_lock(&asdc_wired_tx_lock);
+        asdc_wired_tx_len[free] = len;
+        if (asdc_wired_tx_sending < 0) {
+            asdc_wired_tx_start(free);
+        }
+        k_spin_unlock(&asdc_wired_tx_lock, key);
+    }
+}
+
+static void asdc_wired_tx_done(void) {
+    k_spinlock_key_t key = k_spin_lock(&asdc_wired_tx_lock);
+    int done = asdc_wired_tx_sending;
+    if (done >= 0) {
+        asdc_wired_tx_len[done] = 0;
+        asdc_wired_tx_sending = -1;
+
+        // the other buffer was encoded meanwhile
+        if (asdc_wired_tx_len[!done] > 0) {
+            asdc_wired_tx_start(!done);
+        }
+    }
+    k_spin_unlock(&asdc_wired_tx_lock, key);
+
+    k_work_submit_to_queue(&asdc_work_q, &asdc_wired_tx_work);
+}
+
+//
+// Receiving
+//
+
+static void asdc_wired_rx_frame_done(void) {
+    int len = asdc_cobs_decode(asdc_wired_rx_frame, asdc_wired_rx_len);
+    if (len < (int)ASDC_WIRED_CRC_SIZE) {
+        LOG_WRN("Dropping malformed wired asdc frame");
+        return;
+    }
+
+    len -= ASDC_WIRED_CRC_SIZE;
+    if (crc16_itu_t(0xffff, asdc_wired_rx_frame, len) != sys_get_le16(&asdc_wired_rx_frame[len])) {
+        LOG_WRN("Dropping wired asdc frame with bad CRC");
+        return;
+    }
+
+    asdc_wired_rx_at = k_uptime_get();
+    if (!asdc_wired_connected) {
+        LOG_DBG("Wired asdc peer connected");
+        asdc_wired_connected = true;
+        asdc_on_peer_connected(0);
+    }
+
+    if (len > 0) {
+        asdc_on_data_received(0, asdc_wired_rx_frame, len);
+    }
+}
+
+// splits what the UART received into frames at their delimiters
+static void asdc_wired_rx_bytes(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        const uint8_t *end = memchr(data, 0, len);
+        size_t n = end ? (size_t)(end - data) : len;
+
+        if (n > sizeof(asdc_wired_rx_frame) - asdc_wired_rx_len) {
+            // no frame is this long, drop everything up to the next delimiter
+            asdc_wired_rx_overflow = true;
+        } else {
+            memcpy(&asdc_wired_rx_frame[asdc_wired_rx_len], data, n);
+            asdc_wired_rx_len += n;
+        }
+
+        if (!end) {
+            return;
+        }
+
+        if (asdc_wired_rx_overflow) {
+            LOG_WRN("Dropping oversized wired asdc frame");
+        } else if (asdc_wired_rx_len > 0) {
+            asdc_wired_rx_frame_done();
+        }
+        asdc_wired_rx_len = 0;
+        asdc_wired_rx_overflow = false;
+
+        data += n + 1;
+        len -= n + 1;
+    }
+}
+
+static void asdc_wired_rx_work_callback(struct k_work *work) {
+    uint8_t chunk[CONFIG_ZMK_ARBITRARY_SPLIT_DATA_CHANNEL_WIRED_DMA_BUF_SIZE];
+
+    for (;;) {
+        k_spinlock_key_t key = k_spin_lock(&asdc_wired_rx_lock);
+        uint32_t len = ring_buf_get(&asdc_wired_rx_ring, chunk, sizeof(chunk));
+        k_spin_unlock(&asdc_wired_rx_lock, key);
+
+        if (len == 0) {
+            return;
+        }
+        asdc_wired_rx_bytes(chunk, len);
+    }
+}
+
+static void asdc_wired_rx_enable(void) {
+    asdc_wired_rx_dma_next = 1;
+    int err = uart_rx_enable(asdc_wired_uart, asdc_wired_rx_dma[0], sizeof(asdc_wired_rx_dma[0]),
+                             ASDC_WIRED_RX_TIMEOUT_US);
+    if (err < 0) {
+        LOG_ERR("Failed to enable wired asdc rx (err %d)", err);
+    }
+}
+
+static void asdc_wired_uart_callback(const struct device *dev, struct uart_event *evt, void *user_data) {
+    switch (evt->type) {
+    case UART_TX_DONE:
+    case UART_TX_ABORTED:
+        asdc_wired_tx_done();
+        break;
+
+    case UART_RX_RDY: {
+        k_spinlock_key_t key = k_spin_lock(&asdc_wired_rx_lock);
+        uint32_t put = ring_buf_put(&asdc_wired_rx_ring, evt->data.rx.buf + evt->data.rx.offset,
+                                    evt->data.rx.len);
+        k_spin_unlock(&asdc_wired_rx_lock, key);
+
+        if (put < evt->data.rx.len) {
+            LOG_WRN("Wired asdc rx ring full, dropped %u bytes", evt->data.rx.len - put);
+        }
+        k_work_submit_to_queue(&asdc_work_q, &asdc_wired_rx_work);
+        break;
+    }
+
+    case UART_RX_BUF_REQUEST:
+        uart_rx_buf_rsp(dev, asdc_wired_rx_dma[asdc_wired_rx_dma_next],
+                        sizeof(asdc_wired_rx_dma[0]));
+        asdc_wired_rx_dma_next = !asdc_wired_rx_dma_next;
+        break;
+
+    case UART_RX_STOPPED:
+        LOG_WRN("Wired asdc rx stopped (reason %d)", evt->data.rx_stop.reason);
+        break;
+
+    case UART_RX_DISABLED:
+        // after an rx error, the frame in progress fails its CRC
+        asdc_wired_rx_enable();
+        break;
+
+    default:
+        break;
+    }
+}
+
+//
+// Link state
+//
+
+// queues a keepalive frame and notices a peer that went silent
+static void asdc_wired_link_work_callback(struct k_work *work) {
+    atomic_set(&asdc_wired_keepalive, 1);
+    k_work_submit_to_queue(&asdc_work_q, &asdc_wired_tx_work);
+
+    // runs on the same queue as the rx work, which updates the link state
+    if (asdc_wired_connected && k_uptime_get() - asdc_wired_rx_at > ASDC_WIRED_LINK_TIMEOUT_MS) {
+        LOG_DBG("Wired asdc peer disconnected");
+        asdc_wired_connected = false;
+        asdc_on_peer_disconnected(0);
+    }
+
+    k_work_reschedule_for_queue(&asdc_work_q, &asdc_wired_link_work, K_MSEC(ASDC_WIRED_KEEPALIVE_MS));
+}
+
+//
+// Transport-specific functions
+//
+
+int asdc_transport_init(const struct device *dev) {
+    static bool initialized;
+
+    // called for every channel instance, the UART is set up once
+    if (initialized) {
+        return 0;
+    }
+
+    if (!device_is_ready(asdc_wired_uart)) {
+        LOG_ERR("Wired asdc UART %s is not ready", asdc_wired_uart->name);
+        return -ENODEV;
+    }
+
+    int err = uart_callback_set(asdc_wired_uart, asdc_wired_uart_callback, NULL);
+    if (err < 0) {
+        LOG_ERR("Wired asdc UART %s has no async API (err %d)", asdc_wired_uart->name, err);
+        return err;
+    }
+
+    asdc_wired_rx_enable();
+    k_work_reschedule_for_queue(&asdc_work_q, &asdc_wired_link_work, K_NO_WAIT);
+
+    initialized = true;
+    return 0;
+}
+
+size_t asdc_transport_get_mtu(const struct device *dev, uint8_t peer) {
+    return ASDC_WIRED_MTU;
+}
+
+struct net_buf *asdc_transport_alloc_buf(const struct device *dev, size_t length, k_timeout_t timeout) {
+
+    if (length > ASDC_WIRED_MTU) {
+        LOG_ERR("Length %zu exceeds wired MTU %d", length, ASDC_WIRED_MTU);
+        return NULL;
+    }
+
+    struct net_buf *buf = net_buf_alloc(&asdc_wired_tx_pool, timeout);
+    if (!buf) {
+        LOG_DBG("No free net_buf for wired send");
+        return NULL;
+    }
+
+    return buf;
+}
+
+int asdc_transport_send_buf(const struct device *dev, uint8_t peer, struct net_buf *buf) {
+
+    if (peer != 0 && peer != ASDC_PEER_BROADCAST) {
+        net_buf_unref(buf);
+        return -EINVAL;
+    }
+
+    if (!asdc_peer_is_connected(0)) {
+        LOG_ERR("No wired asdc peer connected for data send");
+        net_buf_unref(buf);
+        return -ENOTCONN;
+    }
+
+    k_fifo_put(&asdc_wired_tx_fifo, buf);
+    k_work_submit_to_queue(&asdc_work_q, &asdc_wired_tx_work);
+    return 0;
+}
+
+int asdc_transport_send_data(const struct device *dev, uint8_t peer, const uint8_t *data, size_t length) {
+    struct net_buf *buf = asdc_transport_alloc_buf(dev, length, K_NO_WAIT);
+    if (!buf) {
+        return -ENOBUFS;
+    }
+
+    net_buf_add_mem(buf, data, length);
+    int err = asdc_transport_send_buf(dev, peer, buf);
+    if (err == -ENOBUFS) {
+        net_buf_unref(buf);
+    }
+    return err;
+}
+
+void asdc_transport_rx_release(void *rx_ctx, struct net_buf *buf) {
+    // received frames are always copied, see asdc_wired_rx_frame_done()
+    net_buf_unref(buf);
+}
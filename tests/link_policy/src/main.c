@@ -0,0 +1,89 @@
+#include <zephyr/ztest.h>
+
+#include "arbitrary_split_data_channel_link_policy.h"
+
+#define SAMPLE_MS 100
+
+static const struct asdc_link_policy policy = {
+    .bulk_queue_depth = 4,
+    .bulk_bytes_per_sec = 2000,
+    .idle_hold_ms = 500,
+    .bulk = {.interval_min = 6, .interval_max = 6, .latency = 0, .timeout = 400},
+    .idle = {.interval_min = 6, .interval_max = 6, .latency = 30, .timeout = 400},
+};
+
+static struct asdc_link_policy_state state;
+
+static bool sample(uint32_t queued, uint32_t bytes_per_sec)
+{
+    return asdc_link_policy_update(&policy, &state, queued, bytes_per_sec, SAMPLE_MS);
+}
+
+static void reset_state(void *fixture)
+{
+    state = (struct asdc_link_policy_state){0};
+}
+
+ZTEST(asdc_link_policy, test_starts_idle)
+{
+    zassert_false(sample(0, 0));
+    zassert_false(state.bulk);
+    zassert_equal_ptr(asdc_link_policy_params(&policy, &state), &policy.idle);
+}
+
+ZTEST(asdc_link_policy, test_queue_depth_threshold)
+{
+    zassert_false(sample(3, 0));
+    zassert_false(state.bulk);
+
+    zassert_true(sample(4, 0));
+    zassert_true(state.bulk);
+    zassert_equal_ptr(asdc_link_policy_params(&policy, &state), &policy.bulk);
+
+    // already there
+    zassert_false(sample(10, 0));
+}
+
+ZTEST(asdc_link_policy, test_rate_threshold)
+{
+    zassert_false(sample(0, 1999));
+    zassert_false(state.bulk);
+
+    zassert_true(sample(0, 2000));
+    zassert_true(state.bulk);
+}
+
+ZTEST(asdc_link_policy, test_idle_hold)
+{
+    zassert_true(sample(4, 0));
+
+    // below both thresholds for less than idle_hold_ms keeps the bulk profile
+    for (int i = 0; i < 4; i++) {
+        zassert_false(sample(3, 1999));
+        zassert_true(state.bulk);
+    }
+
+    zassert_true(sample(0, 0));
+    zassert_false(state.bulk);
+    zassert_equal(state.quiet_ms, 0);
+}
+
+ZTEST(asdc_link_policy, test_burst_restarts_hold)
+{
+    zassert_true(sample(4, 0));
+    for (int i = 0; i < 4; i++) {
+        zassert_false(sample(0, 0));
+    }
+
+    // a burst in the gap starts the hold over
+    zassert_false(sample(0, 2000));
+    zassert_equal(state.quiet_ms, 0);
+    for (int i = 0; i < 4; i++) {
+        zassert_false(sample(0, 0));
+        zassert_true(state.bulk);
+    }
+    zassert_true(sample(0, 0));
+    zassert_false(state.bulk);
+}
+
+ZTEST_SUITE(asdc_link_policy, NULL, NULL, reset_state, NULL, NULL);
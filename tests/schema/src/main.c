@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include <arbitrary_split_data_channel_schema.h>
+
+// two versions of the same message, the second one appends fields
+#define TEST_V1_FIELDS(F) F(U8, source) F(I16, delta) F(BOOL, flag)
+#define TEST_V2_FIELDS(F) TEST_V1_FIELDS(F) F(BYTES, name) F(U32, extra)
+
+ASDC_SCHEMA_DEFINE(test_v1, 0x42, 1, TEST_V1_FIELDS)
+ASDC_SCHEMA_DEFINE(test_v2, 0x42, 2, TEST_V2_FIELDS)
+
+#define TEST_OTHER_FIELDS(F) F(U8, value)
+
+ASDC_SCHEMA_DEFINE(test_other, 0x43, 1, TEST_OTHER_FIELDS)
+
+ZTEST(asdc_schema, test_round_trip)
+{
+    uint8_t buf[test_v2_max_size + 3];
+    const struct test_v2 msg = {
+        .source = 200,
+        .delta = -300,
+        .flag = true,
+        .name = {.data = (const uint8_t *)"abc", .len = 3},
+        .extra = UINT32_MAX,
+    };
+    struct test_v2 parsed;
+
+    int len = test_v2_encode(&msg, buf, sizeof(buf));
+    zassert_true(len > ASDC_SCHEMA_HEADER_SIZE);
+    zassert_equal(buf[0], 0x42);
+    zassert_equal(buf[1], 2);
+
+    zassert_equal(test_v2_decode(&parsed, buf, len), 2);
+    zassert_equal(parsed.source, 200);
+    zassert_equal(parsed.delta, -300);
+    zassert_true(parsed.flag);
+    zassert_equal(parsed.name.len, 3);
+    zassert_mem_equal(parsed.name.data, "abc", 3);
+    zassert_equal(parsed.extra, UINT32_MAX);
+
+    // one byte short of the message
+    zassert_equal(test_v2_encode(&msg, buf, len - 1), -ENOSPC);
+    zassert_equal(test_v2_encode(&msg, buf, 1), -ENOSPC);
+}
+
+ZTEST(asdc_schema, test_truncated_varint)
+{
+    uint64_t v;
+    struct test_v1 parsed;
+
+    // the continuation bit promises a byte that is not there
+    const uint8_t cont[] = {0xff, 0x80};
+    const uint8_t *pos = cont;
+    zassert_false(asdc_schema_get_uint(&pos, cont + sizeof(cont), &v));
+    zassert_equal_ptr(pos, cont);
+
+    pos = cont;
+    zassert_false(asdc_schema_get_uint(&pos, cont, &v));
+
+    // the same inside a message, the delta field is cut off
+    const uint8_t msg[] = {0x42, 1, 0x05, 0x81};
+    zassert_equal(test_v1_decode(&parsed, msg, sizeof(msg)), -EBADMSG);
+
+    // shorter than the type and version bytes
+    zassert_equal(test_v1_decode(&parsed, msg, 1), -EBADMSG);
+}
+
+ZTEST(asdc_schema, test_overlong_varint)
+{
+    uint8_t buf[12];
+    uint64_t v;
+
+    // UINT64_MAX takes all ten bytes, the last one holding only the top bit
+    uint8_t *end = buf;
+    zassert_true(asdc_schema_put_uint(&end, buf + sizeof(buf), UINT64_MAX));
+    zassert_equal(end - buf, 10);
+    zassert_equal(buf[9], 0x01);
+
+    const uint8_t *pos = buf;
+    zassert_true(asdc_schema_get_uint(&pos, end, &v));
+    zassert_equal(v, UINT64_MAX);
+    zassert_equal_ptr(pos, end);
+
+    // a tenth byte beyond 64 bits
+    buf[9] = 0x02;
+    pos = buf;
+    zassert_false(asdc_schema_get_uint(&pos, end, &v));
+
+    // eleven bytes
+    memset(buf, 0x80, sizeof(buf));
+    buf[10] = 0x00;
+    pos = buf;
+    zassert_false(asdc_schema_get_uint(&pos, buf + 11, &v));
+}
+
+ZTEST(asdc_schema, test_zigzag)
+{
+    uint8_t buf[16];
+    uint8_t *end;
+    const uint8_t *pos;
+    int64_t i;
+    int8_t i8;
+    uint8_t u8;
+
+    // small magnitudes stay one byte
+    end = buf;
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), -1));
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), 1));
+    zassert_equal(end - buf, 2);
+    zassert_equal(buf[0], 0x01);
+    zassert_equal(buf[1], 0x02);
+
+    end = buf;
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), INT64_MIN));
+    pos = buf;
+    zassert_true(asdc_schema_get_int(&pos, end, &i));
+    zassert_equal(i, INT64_MIN);
+
+    // the ends of an 8 bit field and one past them, each zigzag encoded in two bytes
+    end = buf;
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), INT8_MIN));
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), INT8_MAX));
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), INT8_MIN - 1));
+    zassert_true(asdc_schema_put_int(&end, buf + sizeof(buf), INT8_MAX + 1));
+    pos = buf;
+    zassert_true(asdc_schema_get_i8(&pos, end, &i8));
+    zassert_equal(i8, INT8_MIN);
+    zassert_true(asdc_schema_get_i8(&pos, end, &i8));
+    zassert_equal(i8, INT8_MAX);
+    zassert_false(asdc_schema_get_i8(&pos, end, &i8));
+    pos = buf + 6;
+    zassert_false(asdc_schema_get_i8(&pos, end, &i8));
+
+    end = buf;
+    zassert_true(asdc_schema_put_uint(&end, buf + sizeof(buf), UINT8_MAX + 1));
+    pos = buf;
+    zassert_false(asdc_schema_get_u8(&pos, end, &u8));
+
+    // a delta that does not fit the I16 field fails the whole message
+    struct test_v1 parsed;
+    uint8_t msg[8] = {0x42, 1, 0x01};
+    end = msg + 3;
+    zassert_true(asdc_schema_put_int(&end, msg + sizeof(msg), INT16_MAX + 1));
+    zassert_equal(test_v1_decode(&parsed, msg, end - msg), -EBADMSG);
+
+    // so does a BOOL other than 0 or 1
+    const uint8_t flag[] = {0x42, 1, 0x01, 0x00, 0x02};
+    zassert_equal(test_v1_decode(&parsed, flag, sizeof(flag)), -EBADMSG);
+}
+
+ZTEST(asdc_schema, test_bytes_overrun)
+{
+    struct asdc_schema_bytes bytes;
+    struct test_v2 parsed;
+
+    // a length of 5 with 4 bytes after it
+    const uint8_t short_bytes[] = {0x05, 'a', 'b', 'c', 'd'};
+    const uint8_t *pos = short_bytes;
+    zassert_false(asdc_schema_get_bytes(&pos, short_bytes + sizeof(short_bytes), &bytes));
+    zassert_equal_ptr(pos, short_bytes);
+
+    // a length that would wrap the pointer
+    const uint8_t huge[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 'a'};
+    pos = huge;
+    zassert_false(asdc_schema_get_bytes(&pos, huge + sizeof(huge), &bytes));
+
+    const uint8_t msg[] = {0x42, 2, 0x01, 0x00, 0x00, 0x03, 'a', 'b'};
+    zassert_equal(test_v2_decode(&parsed, msg, sizeof(msg)), -EBADMSG);
+
+    // empty is fine
+    const uint8_t empty[] = {0x42, 2, 0x01, 0x00, 0x00, 0x00};
+    zassert_equal(test_v2_decode(&parsed, empty, sizeof(empty)), 2);
+    zassert_equal(parsed.name.len, 0);
+}
+
+ZTEST(asdc_schema, test_newer_version)
+{
+    uint8_t buf[test_v2_max_size + 3];
+    const struct test_v2 msg = {
+        .source = 7,
+        .delta = 12,
+        .name = {.data = (const uint8_t *)"xyz", .len = 3},
+        .extra = 99,
+    };
+    struct test_v1 parsed;
+
+    // an older decoder reads the fields it knows and skips the ones appended after them
+    int len = test_v2_encode(&msg, buf, sizeof(buf));
+    zassert_equal(test_v1_decode(&parsed, buf, len), 2);
+    zassert_equal(parsed.source, 7);
+    zassert_equal(parsed.delta, 12);
+    zassert_false(parsed.flag);
+}
+
+ZTEST(asdc_schema, test_older_version)
+{
+    uint8_t buf[test_v1_max_size];
+    const struct test_v1 msg = {.source = 1, .delta = -2, .flag = true};
+    struct test_v2 parsed;
+
+    memset(&parsed, 0xa5, sizeof(parsed));
+
+    // fields the sender did not have yet decode as zero
+    int len = test_v1_encode(&msg, buf, sizeof(buf));
+    zassert_equal(test_v2_decode(&parsed, buf, len), 1);
+    zassert_equal(parsed.source, 1);
+    zassert_equal(parsed.delta, -2);
+    zassert_true(parsed.flag);
+    zassert_equal_ptr(parsed.name.data, NULL);
+    zassert_equal(parsed.name.len, 0);
+    zassert_equal(parsed.extra, 0);
+}
+
+ZTEST(asdc_schema, test_other_type)
+{
+    uint8_t buf[test_other_max_size];
+    const struct test_other msg = {.value = 1};
+    struct test_v1 parsed;
+
+    int len = test_other_encode(&msg, buf, sizeof(buf));
+    zassert_equal(test_v1_decode(&parsed, buf, len), -ENOMSG);
+}
+
+ZTEST_SUITE(asdc_schema, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,161 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include "arbitrary_split_data_channel_wire.h"
+
+// writes the header of packet followed by payload to buf, returns the size of both
+static size_t put_packet(uint8_t *buf, struct asdc_wire_packet *packet, uint8_t version,
+                         bool with_len, const char *payload)
+{
+    packet->len = strlen(payload);
+    size_t header_len = asdc_wire_put_header(buf, packet, version, with_len);
+
+    zassert_equal(header_len, asdc_wire_header_size(packet, version, with_len));
+    memcpy(buf + header_len, payload, packet->len);
+    return header_len + packet->len;
+}
+
+ZTEST(asdc_wire, test_legacy_round_trip)
+{
+    uint8_t buf[32];
+    struct asdc_wire_packet packet = {.channel_id = 0x1234, .flags = 0x05, .seq = 7};
+    struct asdc_wire_packet parsed;
+    size_t len = put_packet(buf, &packet, ASDC_WIRE_VERSION_LEGACY, false, "hello");
+
+    zassert_equal(asdc_wire_parse(buf, len, true, &parsed), ASDC_WIRE_LEGACY_HEADER_SIZE);
+    zassert_equal(parsed.channel_id, 0x1234);
+    zassert_equal(parsed.flags, 0x05);
+    zassert_equal(parsed.seq, 7);
+    zassert_equal(parsed.len, 5);
+    zassert_equal_ptr(parsed.data, buf + ASDC_WIRE_LEGACY_HEADER_SIZE);
+}
+
+ZTEST(asdc_wire, test_compact_round_trip)
+{
+    uint8_t buf[32];
+    struct asdc_wire_packet packet = {.channel_id = 3, .flags = 0x02};
+    struct asdc_wire_packet parsed;
+
+    // on its own the payload takes the rest of the sdu
+    size_t len = put_packet(buf, &packet, ASDC_WIRE_VERSION_COMPACT, false, "abc");
+    zassert_equal(asdc_wire_parse(buf, len, true, &parsed), 2);
+    zassert_equal(parsed.channel_id, 3);
+    zassert_equal(parsed.flags, 0x02);
+    zassert_equal(parsed.seq, 0);
+    zassert_equal(parsed.len, 3);
+
+    // a channel id above 127 takes a second varint byte, seq and length follow it
+    packet.channel_id = 300;
+    packet.seq = 9;
+    len = put_packet(buf, &packet, ASDC_WIRE_VERSION_COMPACT, true, "abcd");
+    zassert_equal(asdc_wire_parse(buf, len + 3, true, &parsed), 5);
+    zassert_equal(parsed.channel_id, 300);
+    zassert_equal(parsed.seq, 9);
+    zassert_equal(parsed.len, 4);
+    zassert_mem_equal(parsed.data, "abcd", 4);
+}
+
+ZTEST(asdc_wire, test_truncated_varint)
+{
+    struct asdc_wire_packet parsed;
+
+    // the channel id varint continues past the end of the sdu
+    uint8_t channel[] = {ASDC_WIRE_COMPACT, 0x81};
+    zassert_equal(asdc_wire_parse(channel, sizeof(channel), true, &parsed), -EBADMSG);
+
+    // so does the length
+    uint8_t len[] = {ASDC_WIRE_COMPACT | ASDC_WIRE_HAS_LEN, 0x01, 0x85};
+    zassert_equal(asdc_wire_parse(len, sizeof(len), true, &parsed), -EBADMSG);
+
+    // the seq byte is missing
+    uint8_t seq[] = {ASDC_WIRE_COMPACT | ASDC_WIRE_HAS_SEQ, 0x01};
+    zassert_equal(asdc_wire_parse(seq, sizeof(seq), true, &parsed), -EBADMSG);
+
+    // a channel id that does not fit 16 bits
+    uint8_t wide[] = {ASDC_WIRE_COMPACT, 0xff, 0xff, 0x04, 'x'};
+    zassert_equal(asdc_wire_parse(wide, sizeof(wide), true, &parsed), -EBADMSG);
+
+    // less than a legacy header, and nothing at all
+    uint8_t legacy[ASDC_WIRE_LEGACY_HEADER_SIZE - 1] = {0x01};
+    zassert_equal(asdc_wire_parse(legacy, sizeof(legacy), true, &parsed), -EBADMSG);
+    zassert_equal(asdc_wire_parse(legacy, 0, true, &parsed), -EBADMSG);
+}
+
+ZTEST(asdc_wire, test_length_overrun)
+{
+    uint8_t buf[32];
+    struct asdc_wire_packet packet = {.channel_id = 1};
+    struct asdc_wire_packet parsed;
+
+    size_t len = put_packet(buf, &packet, ASDC_WIRE_VERSION_COMPACT, true, "abcde");
+    zassert_equal(asdc_wire_parse(buf, len - 1, true, &parsed), -EMSGSIZE);
+
+    len = put_packet(buf, &packet, ASDC_WIRE_VERSION_LEGACY, false, "abcde");
+    zassert_equal(asdc_wire_parse(buf, len - 1, true, &parsed), -EMSGSIZE);
+}
+
+ZTEST(asdc_wire, test_empty_payload)
+{
+    uint8_t buf[32];
+    struct asdc_wire_packet packet = {.channel_id = 1};
+    struct asdc_wire_packet parsed;
+
+    size_t len = put_packet(buf, &packet, ASDC_WIRE_VERSION_COMPACT, false, "");
+    zassert_equal(asdc_wire_parse(buf, len, true, &parsed), -ENODATA);
+
+    len = put_packet(buf, &packet, ASDC_WIRE_VERSION_COMPACT, true, "");
+    zassert_equal(asdc_wire_parse(buf, len, true, &parsed), -ENODATA);
+
+    len = put_packet(buf, &packet, ASDC_WIRE_VERSION_LEGACY, false, "");
+    zassert_equal(asdc_wire_parse(buf, len, true, &parsed), -ENODATA);
+}
+
+ZTEST(asdc_wire, test_reserved_flag)
+{
+    uint8_t buf[] = {ASDC_WIRE_COMPACT | ASDC_WIRE_RESERVED, 0x01, 'x'};
+    struct asdc_wire_packet parsed;
+
+    zassert_equal(asdc_wire_parse(buf, sizeof(buf), true, &parsed), -EPROTONOSUPPORT);
+}
+
+ZTEST(asdc_wire, test_legacy_next_to_compact)
+{
+    uint8_t buf[32];
+    struct asdc_wire_packet first = {.channel_id = 5, .seq = 1};
+    struct asdc_wire_packet second = {.channel_id = 6, .flags = 0x01};
+    struct asdc_wire_packet parsed;
+
+    // a batched sdu of a legacy packet followed by a compact one
+    size_t len = put_packet(buf, &first, ASDC_WIRE_VERSION_LEGACY, false, "ab");
+    len += put_packet(buf + len, &second, ASDC_WIRE_VERSION_COMPACT, false, "xyz");
+
+    int header_len = asdc_wire_parse(buf, len, true, &parsed);
+    zassert_equal(header_len, ASDC_WIRE_LEGACY_HEADER_SIZE);
+    zassert_equal(parsed.channel_id, 5);
+    zassert_equal(parsed.seq, 1);
+    zassert_mem_equal(parsed.data, "ab", 2);
+
+    size_t offset = header_len + parsed.len;
+    header_len = asdc_wire_parse(buf + offset, len - offset, true, &parsed);
+    zassert_equal(header_len, 2);
+    zassert_equal(parsed.channel_id, 6);
+    zassert_equal(parsed.flags, 0x01);
+    zassert_mem_equal(parsed.data, "xyz", 3);
+}
+
+ZTEST(asdc_wire, test_legacy_high_channel_without_compact)
+{
+    uint8_t buf[32];
+    struct asdc_wire_packet packet = {.channel_id = 0x81};
+    struct asdc_wire_packet parsed;
+    size_t len = put_packet(buf, &packet, ASDC_WIRE_VERSION_LEGACY, false, "ab");
+
+    // bit 7 of the first byte only marks a compact header if those are read at all
+    zassert_equal(asdc_wire_parse(buf, len, false, &parsed), ASDC_WIRE_LEGACY_HEADER_SIZE);
+    zassert_equal(parsed.channel_id, 0x81);
+    zassert_equal(parsed.len, 2);
+}
+
+ZTEST_SUITE(asdc_wire, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,169 @@
+// Round trips through the wired transport over an emulated UART in loopback. Everything sent is
+// framed, received again as coming from peer 0 and has to arrive unchanged. Frames put into the
+// UART by hand check that the receiver drops corrupted ones and picks up again after them.
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/ztest.h>
+#include <string.h>
+
+#include <arbitrary_split_data_channel.h>
+#include "arbitrary_split_data_channel_internal.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define TEST_MAX_PAYLOAD 300
+#define TEST_TIMEOUT K_SECONDS(1)
+
+static const struct device *const test_uart = DEVICE_DT_GET(DT_NODELABEL(asdc_uart));
+static const struct device *const test_channel = DEVICE_DT_GET(DT_NODELABEL(asdc_test));
+
+static uint8_t test_rx[TEST_MAX_PAYLOAD];
+static size_t test_rx_len;
+static K_SEM_DEFINE(test_rx_sem, 0, 1);
+
+static uint8_t test_payload[TEST_MAX_PAYLOAD];
+
+static void test_recv(const struct device *dev, uint8_t peer, uint8_t *buf, size_t buflen)
+{
+    zassert_equal(peer, 0);
+    zassert_true(buflen <= sizeof(test_rx));
+    memcpy(test_rx, buf, buflen);
+    test_rx_len = buflen;
+    k_sem_give(&test_rx_sem);
+}
+
+static void round_trip(size_t len)
+{
+    zassert_ok(asdc_send(test_channel, test_payload, len, 0));
+    zassert_ok(k_sem_take(&test_rx_sem, TEST_TIMEOUT), "%zu bytes not received", len);
+    zassert_equal(test_rx_len, len);
+    zassert_mem_equal(test_rx, test_payload, len);
+}
+
+// COBS encodes data into out, which has room for it, and returns the encoded length
+static size_t cobs_encode(const uint8_t *data, size_t len, uint8_t *out)
+{
+    size_t code = 0;
+    size_t pos = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != 0) {
+            out[pos++] = data[i];
+        }
+        if (data[i] == 0 || pos - code == 0xff) {
+            out[code] = pos - code;
+            code = pos++;
+        }
+    }
+    out[code] = pos - code;
+    return pos;
+}
+
+// frames payload as a packet of the test channel the way the other half would, with delimiter
+static size_t put_frame(uint8_t *frame, const uint8_t *payload, size_t len)
+{
+    uint8_t sdu[ASDC_WIRE_LEGACY_HEADER_SIZE + TEST_MAX_PAYLOAD + sizeof(uint16_t)];
+    const struct asdc_wire_packet packet = {.channel_id = 1, .len = len};
+
+    size_t sdu_len = asdc_wire_put_header(sdu, &packet, ASDC_WIRE_VERSION_LEGACY, false);
+    memcpy(&sdu[sdu_len], payload, len);
+    sdu_len += len;
+    sys_put_le16(crc16_itu_t(0xffff, sdu, sdu_len), &sdu[sdu_len]);
+    sdu_len += sizeof(uint16_t);
+
+    size_t frame_len = cobs_encode(sdu, sdu_len, frame);
+    frame[frame_len++] = 0;
+    return frame_len;
+}
+
+static void *wired_setup(void)
+{
+    asdc_register_recv_cb(test_channel, test_recv);
+
+    // the peer, that is this device, connects with its first keepalive
+    for (int i = 0; i < 100 && !asdc_peer_is_connected(0); i++) {
+        k_msleep(10);
+    }
+    zassert_true(asdc_peer_is_connected(0), "keepalives did not come back");
+    return NULL;
+}
+
+static void wired_before(void *fixture)
+{
+    k_sem_reset(&test_rx_sem);
+}
+
+ZTEST(asdc_wired, test_round_trip_without_zeros)
+{
+    for (size_t i = 0; i < sizeof(test_payload); i++) {
+        test_payload[i] = 1 + i % 255;
+    }
+
+    // below, at and beyond one full COBS block of 254 bytes
+    round_trip(1);
+    round_trip(253);
+    round_trip(254);
+    round_trip(255);
+    round_trip(TEST_MAX_PAYLOAD);
+}
+
+ZTEST(asdc_wired, test_round_trip_zeros)
+{
+    memset(test_payload, 0, sizeof(test_payload));
+    round_trip(1);
+    round_trip(TEST_MAX_PAYLOAD);
+
+    // zeros at the ends and next to each other
+    for (size_t i = 0; i < sizeof(test_payload); i++) {
+        test_payload[i] = (i % 7 < 2) ? 0 : i;
+    }
+    round_trip(TEST_MAX_PAYLOAD);
+}
+
+ZTEST(asdc_wired, test_received_frame)
+{
+    static uint8_t frame[2 * TEST_MAX_PAYLOAD];
+
+    memset(test_payload, 0xa5, 16);
+    test_payload[3] = 0;
+    size_t len = put_frame(frame, test_payload, 16);
+
+    uart_emul_put_rx_data(test_uart, frame, len);
+    zassert_ok(k_sem_take(&test_rx_sem, TEST_TIMEOUT));
+    zassert_equal(test_rx_len, 16);
+    zassert_mem_equal(test_rx, test_payload, 16);
+}
+
+ZTEST(asdc_wired, test_corrupted_frame_dropped)
+{
+    static uint8_t frame[2 * TEST_MAX_PAYLOAD];
+
+    memset(test_payload, 0x5a, 16);
+    size_t len = put_frame(frame, test_payload, 16);
+
+    // a flipped payload bit fails the CRC
+    frame[len / 2] ^= 0x01;
+    uart_emul_put_rx_data(test_uart, frame, len);
+    zassert_equal(k_sem_take(&test_rx_sem, K_MSEC(200)), -EAGAIN);
+
+    // a COBS code byte pointing past the delimiter
+    frame[len / 2] ^= 0x01;
+    frame[0] = 0xfe;
+    uart_emul_put_rx_data(test_uart, frame, len);
+    zassert_equal(k_sem_take(&test_rx_sem, K_MSEC(200)), -EAGAIN);
+
+    // the next good frame still arrives
+    put_frame(frame, test_payload, 16);
+    uart_emul_put_rx_data(test_uart, frame, len);
+    zassert_ok(k_sem_take(&test_rx_sem, TEST_TIMEOUT));
+    zassert_mem_equal(test_rx, test_payload, 16);
+}
+
+ZTEST_SUITE(asdc_wired, NULL, wired_setup, wired_before, NULL, NULL);